@@ -2,12 +2,13 @@
 
 #include"Ray.h"
 
-class AABB
+template <typename T>
+class AABBT
 {
 
     void padIntervals()
     {
-        double delta = 0.0001;
+        T delta = T(0.0001);
         if (x_.size() < delta) 
             x_ = x_.expand(delta);
         if (y_.size() < delta)
@@ -21,28 +22,28 @@ public:
     {
         struct
         {
-            Interval x_, y_, z_;
+            IntervalT<T> x_, y_, z_;
         };
 
-        Interval data_[3];
+        IntervalT<T> data_[3];
     };
 
-    AABB() {} // The default AABB is empty, since intervals are empty by default.
+    AABBT() : x_(), y_(), z_() {} // The default AABB is empty, each interval is constructed empty.
 
-    AABB(const Interval& x, const Interval& y, const Interval& z) : x_(x), y_(y), z_(z)
+    AABBT(const IntervalT<T>& x, const IntervalT<T>& y, const IntervalT<T>& z) : x_(x), y_(y), z_(z)
     {
         padIntervals();
     }
 
-    AABB(const vec3& a, const vec3& b)
+    AABBT(const Vec3T<T>& a, const Vec3T<T>& b)
     {   // Treat the two points a and b as extrema for the bounding box, so we don't require a
-        x_ = (a[0] <= b[0]) ? Interval(a[0], b[0]) : Interval(b[0], a[0]);
-        y_ = (a[1] <= b[1]) ? Interval(a[1], b[1]) : Interval(b[1], a[1]);
-        z_ = (a[2] <= b[2]) ? Interval(a[2], b[2]) : Interval(b[2], a[2]);
+        x_ = (a[0] <= b[0]) ? IntervalT<T>(a[0], b[0]) : IntervalT<T>(b[0], a[0]);
+        y_ = (a[1] <= b[1]) ? IntervalT<T>(a[1], b[1]) : IntervalT<T>(b[1], a[1]);
+        z_ = (a[2] <= b[2]) ? IntervalT<T>(a[2], b[2]) : IntervalT<T>(b[2], a[2]);
         padIntervals();
     }
 
-    AABB(AABB b1, AABB b2)
+    AABBT(AABBT b1, AABBT b2)
     {
         x_ = unite(b1.x_, b2.x_);
         y_ = unite(b1.y_, b2.y_);
@@ -53,7 +54,7 @@ public:
     int longestAxis() const
     {
         int axis = 0;
-        double size = x_.size();
+        T size = x_.size();
         if (size < y_.size())
            size = y_.size(), axis = 1;
         if (size < z_.size())
@@ -61,38 +62,57 @@ public:
         return axis;
     }
 
-    bool hit(const Ray& r, Interval ray_t) const
+    T surfaceArea() const
     {
-        Interval temp;
-        for (int axis = 0; axis < 3; axis++)
-        {
-            
-            const double& ray_center = r.orig_.data[axis];
-            const double& ray_direction = r.dir_.data[axis];
+        T dx = x_.size(), dy = y_.size(), dz = z_.size();
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0;
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
 
-            temp.min_ = min((data_[axis].max_ - ray_center) / ray_direction, (data_[axis].min_ - ray_center) / ray_direction);
-            temp.max_ = max((data_[axis].max_ - ray_center) / ray_direction, (data_[axis].min_ - ray_center) / ray_direction);
-            ray_t = intersect(temp, ray_t);
+    T centroid(int axis) const
+    {
+        return T(0.5) * (data_[axis].min_ + data_[axis].max_);
+    }
 
-            if (ray_t.max_ <= ray_t.min_)
-                return false;
+    bool hit(const RayT<T>& r, IntervalT<T> ray_t) const
+    {
+        T t_min = ray_t.min_, t_max = ray_t.max_;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // the direction sign picks the plane the ray enters through, so there is no swap and no early exit
+            const IntervalT<T>& slab = data_[axis];
+            T t_enter = ((r.sign_[axis] ? slab.max_ : slab.min_) - r.orig_.data[axis]) * r.inverse_dir_.data[axis];
+            T t_leave = ((r.sign_[axis] ? slab.min_ : slab.max_) - r.orig_.data[axis]) * r.inverse_dir_.data[axis] * T(SlabSlack);
+
+            // an origin lying on a plane of a zero direction axis gives 0 * inf = NaN,
+            // the comparisons are written so NaN keeps the current interval instead of poisoning it
+            t_min = (t_enter > t_min) ? t_enter : t_min;
+            t_max = (t_leave < t_max) ? t_leave : t_max;
         }
 
-        return true;
+        return t_min < t_max;
     }
 
-    static const AABB Empty, Universe;
+    static const AABBT Empty, Universe;
 };
 
-const AABB AABB::Empty(Interval::Empty, Interval::Empty, Interval::Empty);
-const AABB AABB::Universe(Interval::Universe, Interval::Universe, Interval::Universe);
+// built from fresh intervals rather than IntervalT::Empty and Universe, the initialization order of static members of templates is unspecified
+template <typename T>
+const AABBT<T> AABBT<T>::Empty = AABBT<T>(IntervalT<T>(), IntervalT<T>(), IntervalT<T>());
+template <typename T>
+const AABBT<T> AABBT<T>::Universe = AABBT<T>(IntervalT<T>(T(-Infinity), T(Infinity)), IntervalT<T>(T(-Infinity), T(Infinity)), IntervalT<T>(T(-Infinity), T(Infinity)));
 
-AABB operator+(const AABB& bounding_box, const vec3& offset)
+template <typename T>
+AABBT<T> operator+(const AABBT<T>& bounding_box, const Vec3T<T>& offset)
 {
-    return AABB(bounding_box.x_ + offset.x, bounding_box.y_ + offset.y, bounding_box.z_ + offset.z);
+    return AABBT<T>(bounding_box.x_ + offset.x, bounding_box.y_ + offset.y, bounding_box.z_ + offset.z);
 }
 
-AABB operator+(const vec3& offset, const AABB& bounding_box)
+template <typename T>
+AABBT<T> operator+(const Vec3T<T>& offset, const AABBT<T>& bounding_box)
 {
     return bounding_box + offset;
-}
\ No newline at end of file
+}
+
+using AABB = AABBT<Real>;
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "camera.h"
+#include "linear_bvh.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+// moves the objects of frame (Instance::setTransform, ...) and appends every object it moved to moved
+using AnimateFrame = std::function<void(int frame, std::vector<const Hittable*>& moved)>;
+
+// renders frame_count frames to path_prefix0000.tga, path_prefix0001.tga, ...; between frames the BVH is only
+// refit along the paths of the moved objects, so the setup cost follows what moved instead of the scene size
+inline void RenderAnimation(Camera& camera, LinearBVH& bvh, int frame_count, const AnimateFrame& animate, const std::string& path_prefix = "Export/frame")
+{
+	std::vector<const Hittable*> moved;
+	for (int frame = 0; frame < frame_count; frame++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		moved.clear();
+		animate(frame, moved);
+		int rebuilt = bvh.update(moved);
+		double setup = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Frame " << frame << ": " << moved.size() << " moved, " << rebuilt << " subtrees rebuilt, setup " << setup << "ms\n";
+
+		char number[16];
+		snprintf(number, sizeof(number), "%04d.tga", frame);
+		camera.image_path_ = path_prefix + number;
+		camera.render(bvh);
+	}
+}
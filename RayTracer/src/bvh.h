@@ -1,12 +1,14 @@
 #pragma once
 
 #include "hittable_list.h"
+#include "bvh_builder.h"
 
 class BVHNode : public Hittable
 {
 
 	AABB bounding_box_;
 	std::shared_ptr<Hittable> left, right;
+	BVHStatistics statistics_;
 
 	static bool boundingBoxXComparator(std::shared_ptr<Hittable> a, std::shared_ptr<Hittable> b)
 	{
@@ -23,10 +25,55 @@ class BVHNode : public Hittable
 		return a->getBoundingBox().z_.min_ < b->getBoundingBox().z_.min_;
 	}
 
+	static std::vector<AABB> getBounds(const HittableList& list)
+	{
+		std::vector<AABB> bounds;
+		bounds.reserve(list.objects_.size());
+		for (const auto& object : list.objects_)
+			bounds.push_back(object->getBoundingBox());
+		return bounds;
+	}
+
 public:
 
 	BVHNode(HittableList list) : BVHNode(list.objects_, 0, list.objects_.size()) {}
 
+	// builds the tree with BVHBuilder (binned SAH by default) instead of sorting at every level
+	BVHNode(const HittableList& list, const BVHBuildOptions& options) : BVHNode(BVHBuilder(getBounds(list), options), 0, list.objects_) {}
+
+	BVHNode(const BVHBuilder& builder, int node_index, const std::vector<std::shared_ptr<Hittable>>& objects)
+	{
+		const BVHBuildNode& node = builder.getNodes()[node_index];
+		bounding_box_ = node.bounding_box_;
+		if (node_index == 0)
+			statistics_ = builder.getStatistics();
+
+		if (!node.isLeaf())
+		{
+			left = std::make_shared<BVHNode>(builder, node.left_, objects);
+			right = std::make_shared<BVHNode>(builder, node.right_, objects);
+			return;
+		}
+
+		const std::vector<int>& order = builder.getPrimitiveOrder();
+		if (node.primitive_count_ == 1)
+		{
+			left = right = objects[order[node.first_primitive_]];
+		}
+		else if (node.primitive_count_ == 2)
+		{
+			left = objects[order[node.first_primitive_]];
+			right = objects[order[node.first_primitive_ + 1]];
+		}
+		else
+		{
+			auto leaf = std::make_shared<HittableList>();
+			for (int i = 0; i < node.primitive_count_; i++)
+				leaf->add(objects[order[node.first_primitive_ + i]]);
+			left = right = leaf;
+		}
+	}
+
 	BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end)
 	{
 		bounding_box_ = AABB::Empty;
@@ -63,13 +110,35 @@ public:
 		if (!bounding_box_.hit(r, ray_t))
 			return false;
 		bool hit_left = left->hit(r, ray_t, rec);
+		if (right == left)
+			return hit_left;
 		bool hit_right = right->hit(r, Interval(ray_t.min_, hit_left ? rec.t_ : ray_t.max_), rec);
 
 		return hit_right || hit_left;
 	}
 
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (!bounding_box_.hit(r, ray_t))
+			return false;
+		return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+	}
+
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
 	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		left->collectLights(lights);
+		if (right != left)
+			right->collectLights(lights);
+	}
+
+	// only filled in for trees made by BVHBuilder
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
 };
\ No newline at end of file
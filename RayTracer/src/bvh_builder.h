@@ -0,0 +1,420 @@
+#pragma once
+
+#include "aabb.h"
+#include <atomic>
+#include <chrono>
+
+struct BVHBuildOptions
+{
+	enum class Method { Median, SAH };
+
+	Method method_ = Method::SAH;
+	int bin_count_ = 16; // SAH candidate splits per axis are the borders between bins
+	int max_leaf_size_ = 4;
+	double traversal_cost_ = 1.0; // cost of visiting an interior node, relative to...
+	double intersection_cost_ = 1.0; // ...the cost of testing one primitive
+	int thread_count_ = 0; // 0 uses every hardware thread
+	int parallel_threshold_ = 4096; // smaller ranges are built by the thread that reaches them
+};
+
+struct BVHBuildNode
+{
+	AABB bounding_box_;
+	int left_ = -1, right_ = -1; // child node indices, -1 in leaves
+	int first_primitive_ = 0, primitive_count_ = 0; // range into the builder's primitive order, used by leaves
+	int axis_ = 0; // split axis of interior nodes
+
+	bool isLeaf() const
+	{
+		return left_ < 0;
+	}
+};
+
+struct BVHStatistics
+{
+	double sah_cost_ = 0; // expected cost of a random ray hitting the root, in primitive tests
+	int depth_ = 0;
+	int node_count_ = 0;
+	int leaf_count_ = 0;
+	int largest_leaf_ = 0;
+	int primitive_count_ = 0;
+	double build_seconds_ = 0;
+
+	double primitivesPerSecond() const
+	{
+		return (build_seconds_ > 0) ? primitive_count_ / build_seconds_ : 0;
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << "BVH: SAH cost " << sah_cost_ << ", depth " << depth_ << ", nodes " << node_count_
+			<< ", leaves " << leaf_count_ << ", largest leaf " << largest_leaf_ << '\n';
+		out << "BVH: built " << primitive_count_ << " primitives in " << build_seconds_ * 1000 << "ms ("
+			<< primitivesPerSecond() / 1e6 << "M primitives/s)\n";
+	}
+};
+
+// builds a binary tree over primitive bounding boxes, nodes are stored in depth first order
+// (the left child of node i is node i + 1) so the result can be flattened or materialized directly;
+// big builds run in parallel: the halves of large splits become tasks on spare threads, the largest
+// ranges are bounded and binned in chunks, and nodes come from a shared counter until they are put in order at the end
+class BVHBuilder
+{
+
+	struct Bin
+	{
+		AABB bounding_box_ = AABB::Empty;
+		int count_ = 0;
+	};
+
+	// what the threads of one build share, kept out of the builder so it stays movable
+	struct SharedState
+	{
+		std::atomic<int> next_node_{ 1 }; // the root is node 0, children are allocated in pairs
+		std::atomic<int> spare_threads_{ 0 };
+	};
+
+	static const int min_chunk_size_ = 16384; // below this, starting a thread costs more than binning the range
+
+	BVHBuildOptions options_;
+	std::vector<AABB> primitive_bounds_;
+	std::vector<int> primitive_order_;
+	std::vector<BVHBuildNode> nodes_;
+	BVHStatistics statistics_;
+
+	int getBin(int primitive, int axis, const Interval& centroid_bounds) const
+	{
+		double extent = centroid_bounds.size();
+		int bin = int(options_.bin_count_ * (primitive_bounds_[primitive].centroid(axis) - centroid_bounds.min_) / extent);
+		return (bin < options_.bin_count_) ? bin : options_.bin_count_ - 1;
+	}
+
+	// takes up to wanted threads from the spare ones without waiting, returns how many it got
+	static int takeSpareThreads(SharedState& shared, int wanted)
+	{
+		int available = shared.spare_threads_.load();
+		while (available > 0)
+		{
+			int taken = (available < wanted) ? available : wanted;
+			if (shared.spare_threads_.compare_exchange_weak(available, available - taken))
+				return taken;
+		}
+		return 0;
+	}
+
+	// the number of chunks a range is split into, the caller gives the extra threads back when it is done
+	static int takeChunkCount(int count, SharedState& shared)
+	{
+		int wanted = count / min_chunk_size_ - 1;
+		return 1 + ((wanted > 0) ? takeSpareThreads(shared, wanted) : 0);
+	}
+
+	// runs body(chunk, chunk_start, chunk_end) on every chunk of [start, end), the calling thread takes the first one
+	template <typename Body>
+	static void forEachChunk(int start, int end, int chunk_count, const Body& body)
+	{
+		auto chunkStart = [start, end, chunk_count](int chunk)
+			{
+				return start + int(int64_t(end - start) * chunk / chunk_count);
+			};
+		std::vector<std::thread> workers;
+		for (int chunk = 1; chunk < chunk_count; chunk++)
+			workers.emplace_back([&body, &chunkStart, chunk] { body(chunk, chunkStart(chunk), chunkStart(chunk + 1)); });
+		body(0, chunkStart(0), chunkStart(1));
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	void boundRange(int start, int end, AABB& bounding_box, Interval* centroid_bounds) const
+	{
+		for (int i = start; i < end; i++)
+		{
+			const AABB& primitive_box = primitive_bounds_[primitive_order_[i]];
+			bounding_box = AABB(bounding_box, primitive_box);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				double centroid = primitive_box.centroid(axis);
+				centroid_bounds[axis] = unite(centroid_bounds[axis], Interval(centroid, centroid));
+			}
+		}
+	}
+
+	// bins the range along every axis the centroids spread over at once, bins[axis * bin_count + bin]
+	void binRange(int start, int end, const Interval* centroid_bounds, Bin* bins) const
+	{
+		int bin_count = options_.bin_count_;
+		for (int i = start; i < end; i++)
+		{
+			int primitive = primitive_order_[i];
+			const AABB& primitive_box = primitive_bounds_[primitive];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (centroid_bounds[axis].size() <= 0)
+					continue;
+				Bin& bin = bins[axis * bin_count + getBin(primitive, axis, centroid_bounds[axis])];
+				bin.bounding_box_ = AABB(bin.bounding_box_, primitive_box);
+				bin.count_++;
+			}
+		}
+	}
+
+	// returns the middle of the range after partially ordering it around the median centroid
+	int medianSplit(int start, int end, int axis)
+	{
+		int mid = start + (end - start) / 2;
+		std::nth_element(primitive_order_.begin() + start, primitive_order_.begin() + mid, primitive_order_.begin() + end,
+			[this, axis](int a, int b)
+			{
+				return primitive_bounds_[a].centroid(axis) < primitive_bounds_[b].centroid(axis);
+			});
+		return mid;
+	}
+
+	// returns the split position, or -1 when a leaf is cheaper than any split
+	int sahSplit(int start, int end, const AABB& bounding_box, const Interval* centroid_bounds, int& split_axis, SharedState& shared)
+	{
+		int count = end - start, bin_count = options_.bin_count_;
+		double best_cost = Infinity;
+		int best_axis = -1, best_bin = 0;
+		std::vector<Bin> bins(3 * bin_count);
+		std::vector<double> right_area(bin_count);
+		std::vector<int> right_count(bin_count);
+
+		// bins only hold unions and counts, so merging the chunks gives exactly the bins of a single pass
+		int chunk_count = takeChunkCount(count, shared);
+		if (chunk_count == 1)
+			binRange(start, end, centroid_bounds, bins.data());
+		else
+		{
+			std::vector<std::vector<Bin>> chunk_bins(chunk_count, std::vector<Bin>(3 * bin_count, Bin()));
+			forEachChunk(start, end, chunk_count, [this, centroid_bounds, &chunk_bins](int chunk, int chunk_start, int chunk_end)
+				{
+					binRange(chunk_start, chunk_end, centroid_bounds, chunk_bins[chunk].data());
+				});
+			shared.spare_threads_ += chunk_count - 1;
+			for (const std::vector<Bin>& partial : chunk_bins)
+				for (int i = 0; i < 3 * bin_count; i++)
+				{
+					bins[i].bounding_box_ = AABB(bins[i].bounding_box_, partial[i].bounding_box_);
+					bins[i].count_ += partial[i].count_;
+				}
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (centroid_bounds[axis].size() <= 0)
+				continue;
+			const Bin* axis_bins = &bins[axis * bin_count];
+
+			// sweeping from the right, right_*[i] describe the bins i..bin_count - 1
+			AABB accumulated = AABB::Empty;
+			int accumulated_count = 0;
+			for (int i = bin_count - 1; i > 0; i--)
+			{
+				if (axis_bins[i].count_)
+					accumulated = AABB(accumulated, axis_bins[i].bounding_box_);
+				accumulated_count += axis_bins[i].count_;
+				right_area[i] = accumulated.surfaceArea();
+				right_count[i] = accumulated_count;
+			}
+
+			// sweeping from the left, splitting between bin i - 1 and bin i
+			accumulated = AABB::Empty;
+			accumulated_count = 0;
+			for (int i = 1; i < bin_count; i++)
+			{
+				if (axis_bins[i - 1].count_)
+					accumulated = AABB(accumulated, axis_bins[i - 1].bounding_box_);
+				accumulated_count += axis_bins[i - 1].count_;
+				if (!accumulated_count || !right_count[i])
+					continue;
+
+				double cost = accumulated_count * accumulated.surfaceArea() + right_count[i] * right_area[i];
+				if (cost < best_cost)
+					best_cost = cost, best_axis = axis, best_bin = i;
+			}
+		}
+
+		if (best_axis < 0)
+			return -1;
+
+		double area = bounding_box.surfaceArea();
+		best_cost = options_.traversal_cost_ + options_.intersection_cost_ * best_cost / ((area > 0) ? area : 1);
+		if (count <= options_.max_leaf_size_ && count * options_.intersection_cost_ <= best_cost)
+			return -1;
+
+		split_axis = best_axis;
+		auto middle = std::partition(primitive_order_.begin() + start, primitive_order_.begin() + end,
+			[this, best_axis, best_bin, centroid_bounds](int primitive)
+			{
+				return getBin(primitive, best_axis, centroid_bounds[best_axis]) < best_bin;
+			});
+		return int(middle - primitive_order_.begin());
+	}
+
+	// every task owns its range of the primitive order and the nodes it allocates, so nothing else is shared
+	void build(int node_index, int start, int end, SharedState& shared)
+	{
+		int count = end - start;
+		AABB bounding_box = AABB::Empty;
+		Interval centroid_bounds[3];
+		int chunk_count = takeChunkCount(count, shared);
+		if (chunk_count == 1)
+			boundRange(start, end, bounding_box, centroid_bounds);
+		else
+		{
+			std::vector<AABB> chunk_boxes(chunk_count, AABB::Empty);
+			std::vector<Interval> chunk_centroids(3 * chunk_count);
+			forEachChunk(start, end, chunk_count, [this, &chunk_boxes, &chunk_centroids](int chunk, int chunk_start, int chunk_end)
+				{
+					boundRange(chunk_start, chunk_end, chunk_boxes[chunk], &chunk_centroids[3 * chunk]);
+				});
+			shared.spare_threads_ += chunk_count - 1;
+			for (int chunk = 0; chunk < chunk_count; chunk++)
+			{
+				bounding_box = AABB(bounding_box, chunk_boxes[chunk]);
+				for (int axis = 0; axis < 3; axis++)
+					centroid_bounds[axis] = unite(centroid_bounds[axis], chunk_centroids[3 * chunk + axis]);
+			}
+		}
+
+		int axis = 0, mid = -1;
+		if (count > 1)
+		{
+			if (options_.method_ == BVHBuildOptions::Method::SAH)
+			{
+				mid = sahSplit(start, end, bounding_box, centroid_bounds, axis, shared);
+				// a split the bins can't express (coincident centroids) still has to happen in oversized leaves
+				if (mid < 0 && count > options_.max_leaf_size_)
+					axis = bounding_box.longestAxis(), mid = medianSplit(start, end, axis);
+			}
+			else if (count > options_.max_leaf_size_)
+			{
+				axis = bounding_box.longestAxis();
+				mid = medianSplit(start, end, axis);
+			}
+		}
+
+		// nodes_ was sized for the largest possible tree up front, so it never moves while tasks write to it
+		BVHBuildNode& node = nodes_[node_index];
+		node.bounding_box_ = bounding_box;
+		node.first_primitive_ = start;
+		node.primitive_count_ = count;
+		if (mid < 0)
+			return;
+
+		int left = shared.next_node_.fetch_add(2), right = left + 1;
+		node.left_ = left;
+		node.right_ = right;
+		node.axis_ = axis;
+
+		// the left half becomes a task of its own when both halves are big enough to be worth a thread
+		if (mid - start >= options_.parallel_threshold_ && end - mid >= options_.parallel_threshold_ && takeSpareThreads(shared, 1))
+		{
+			std::thread worker([this, left, start, mid, &shared]
+				{
+					build(left, start, mid, shared);
+					shared.spare_threads_++;
+				});
+			build(right, mid, end, shared);
+			worker.join();
+		}
+		else
+		{
+			build(left, start, mid, shared);
+			build(right, mid, end, shared);
+		}
+	}
+
+	// the tasks allocated children in pairs in whatever order they got to them,
+	// this renumbers the tree so the left child of node i is node i + 1 again
+	void sortDepthFirst()
+	{
+		std::vector<BVHBuildNode> allocated;
+		allocated.swap(nodes_);
+		nodes_.reserve(allocated.size());
+
+		std::vector<std::pair<int, int>> stack; // allocated node, new index of the parent it is the right child of
+		stack.push_back({ 0, -1 });
+		while (!stack.empty())
+		{
+			std::pair<int, int> entry = stack.back();
+			stack.pop_back();
+
+			int new_index = int(nodes_.size());
+			const BVHBuildNode& node = allocated[entry.first];
+			nodes_.push_back(node);
+			if (entry.second >= 0)
+				nodes_[entry.second].right_ = new_index;
+			if (!node.isLeaf())
+			{
+				nodes_[new_index].left_ = new_index + 1;
+				stack.push_back({ node.right_, new_index });
+				stack.push_back({ node.left_, -1 });
+			}
+		}
+	}
+
+	void gatherStatistics(int node_index, int depth, double root_area)
+	{
+		const BVHBuildNode& node = nodes_[node_index];
+		double relative_area = (root_area > 0) ? node.bounding_box_.surfaceArea() / root_area : 1;
+
+		statistics_.node_count_++;
+		statistics_.depth_ = (depth > statistics_.depth_) ? depth : statistics_.depth_;
+		if (node.isLeaf())
+		{
+			statistics_.leaf_count_++;
+			statistics_.largest_leaf_ = (node.primitive_count_ > statistics_.largest_leaf_) ? node.primitive_count_ : statistics_.largest_leaf_;
+			statistics_.sah_cost_ += relative_area * options_.intersection_cost_ * node.primitive_count_;
+			return;
+		}
+		statistics_.sah_cost_ += relative_area * options_.traversal_cost_;
+		gatherStatistics(node.left_, depth + 1, root_area);
+		gatherStatistics(node.right_, depth + 1, root_area);
+	}
+
+public:
+
+	BVHBuilder(std::vector<AABB> primitive_bounds, const BVHBuildOptions& options = BVHBuildOptions())
+		: options_(options), primitive_bounds_(std::move(primitive_bounds))
+	{
+		auto start_time = std::chrono::steady_clock::now();
+		options_.bin_count_ = (options_.bin_count_ < 2) ? 2 : options_.bin_count_;
+		options_.max_leaf_size_ = (options_.max_leaf_size_ < 1) ? 1 : options_.max_leaf_size_;
+		int thread_count = (options_.thread_count_ > 0) ? options_.thread_count_ : int(std::thread::hardware_concurrency());
+
+		int primitive_count = int(primitive_bounds_.size());
+		primitive_order_.resize(primitive_count);
+		for (int i = 0; i < primitive_count; i++)
+			primitive_order_[i] = i;
+
+		// leaves are never empty, so there are at most 2n - 1 nodes
+		nodes_.resize((primitive_count > 1) ? 2 * size_t(primitive_count) - 1 : 1);
+		SharedState shared;
+		shared.spare_threads_ = (thread_count > 1) ? thread_count - 1 : 0;
+		build(0, 0, primitive_count, shared);
+		nodes_.resize(shared.next_node_.load());
+		sortDepthFirst();
+
+		statistics_.primitive_count_ = primitive_count;
+		statistics_.build_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		gatherStatistics(0, 1, nodes_[0].bounding_box_.surfaceArea());
+	}
+
+	const std::vector<BVHBuildNode>& getNodes() const
+	{
+		return nodes_;
+	}
+
+	// leaf primitive ranges index into this array, which maps them back to the input order
+	const std::vector<int>& getPrimitiveOrder() const
+	{
+		return primitive_order_;
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+};
@@ -2,7 +2,8 @@
 
 #include "utility.h"
 #include "hittable.h"
-#include "material.h"
+#include "light.h"
+#include "scheduler.h"
 
 class Camera {
 
@@ -14,27 +15,90 @@ private:
 		pixel00_loc_, // we start from the bottom left of the viewport
 		defocus_disk_right_,
 		defocus_disk_up_;
-	std::vector<unsigned int> x_iterator_,
-		y_iterator_;
+	LightList lights_;
+	double pixel_spread_angle_ = 0; // angle between the rays through neighboring pixels, the spread of a ray cone
 
-	Color rayColor(const Ray& r, int cur_depth, const Hittable& object) const 
+	Color rayColor(Ray r, int max_depth, const Hittable& object) const 
 	{
-		if(cur_depth <= 0)
-			return Color(0, 0, 0);
-
+		Color radiance(0, 0, 0), throughput(1, 1, 1);
 		HitRecord record;
-		if (!object.hit(r, Interval(0.001, Infinity), record))
-			return background_color_;
 		Ray scattered;
 		Color attenuation;
-		Color emissive_color = record.material_->emit(record.u_, record.v_, record.intersection_point_);
+		// density of the last diffuse bounce, 0 for camera rays and after specular bounces
+		double scattering_pdf = 0;
+		vec3 scattering_origin;
+		// the pixel's footprint is followed as a cone around the path, its width grows with every distance traveled
+		double cone_width = 0;
+
+		for (int depth = 0; depth < max_depth; depth++)
+		{
+			if (!object.hit(r, Interval(RayOffset(r.orig_), Infinity), record))
+			{
+				radiance += throughput * background_color_;
+				break;
+			}
+			const Hittable* hit_object = record.object_; // finalize() clears it
+			record.finalize(r);
+
+			double direction_length = r.dir_.length();
+			cone_width += pixel_spread_angle_ * record.t_ * direction_length;
+			record.footprint_ = 0;
+			if (record.uv_density_ > 0)
+			{
+				// at a grazing angle the cone covers a 1 / cosine longer stretch of the surface along one axis only,
+				// the footprint is the width of a square with the same area
+				double cosine = fabs(dot(r.dir_, record.normal_)) / direction_length;
+				record.footprint_ = cone_width * record.uv_density_ / std::sqrt(std::fmax(cosine, 1e-3));
+			}
+
+			Color emitted = record.material_->emit(record.u_, record.v_, record.intersection_point_);
+			// after a diffuse bounce light sampling could have found this emitter too, both estimates share it
+			if (scattering_pdf > 0)
+				emitted *= PowerHeuristic(scattering_pdf, lights_.pdf(hit_object, scattering_origin, r.dir_));
+			radiance += throughput * emitted;
 
-		if (!record.material_->scatter(r, record, attenuation, scattered))
-			return emissive_color;
+			if (!record.material_->scatter(r, record, attenuation, scattered))
+				break;
+
+			scattering_pdf = 0;
+			if (record.material_->isDiffuse())
+			{
+				// next event estimation: a shadow ray towards a point picked on one of the lights
+				LightSample light;
+				if (lights_.sample(record.intersection_point_, light))
+				{
+					vec3 direction = light.point_ - record.intersection_point_;
+					double distance = direction.length();
+					double light_scattering_pdf = record.material_->scatteringPdf(r, record, direction);
+
+					if (light_scattering_pdf > 0 && !object.occluded(Ray(record.intersection_point_, direction / distance, r.time_), Interval(RayOffset(record.intersection_point_), distance - RayOffset(light.point_))))
+						radiance += throughput * attenuation * light.emission_ * (light_scattering_pdf * PowerHeuristic(light.pdf_, light_scattering_pdf) / light.pdf_);
+				}
+
+				scattering_pdf = record.material_->scatteringPdf(r, record, scattered.dir_);
+				scattering_origin = record.intersection_point_;
+			}
 
-		Color scattering_color = attenuation * rayColor(scattered, cur_depth - 1, object);
+			throughput = throughput * attenuation;
 
-		return emissive_color + scattering_color;
+			// russian roulette: a dim path survives with probability proportional to its throughput and is
+			// scaled up by the inverse of that probability, so the estimate stays unbiased
+			if (depth + 1 >= russian_roulette_depth_)
+			{
+				double strength = std::fmax(throughput.r, std::fmax(throughput.g, throughput.b));
+				if (strength < russian_roulette_threshold_)
+				{
+					double survival = strength / russian_roulette_threshold_;
+					if (RandomDouble() >= survival)
+						break;
+					throughput *= 1.0 / survival;
+				}
+			}
+
+			r = scattered;
+		}
+
+		return radiance;
 	}
 
 	Ray getRay(int i, int j)
@@ -60,36 +124,54 @@ private:
 		return camera_position_ + disk_sample.x * defocus_disk_right_ + disk_sample.y * defocus_disk_up_;
 	}
 
+	void renderTile(const TileScheduler::Tile& tile, const Hittable& world)
+	{
+		for (int j = tile.y_min_; j < tile.y_max_; j++)
+			for (int i = tile.x_min_; i < tile.x_max_; i++)
+			{
+				Color c(0.0, 0.0, 0.0);
+
+				for (int sample = 0; sample < samples_per_pixel_; sample++) {
+
+					// every sample gets its own random stream, so the image is the same for any thread count
+					SeedThreadGenerator(uint64_t(j) * image_width_ + i, sample);
+					Ray r = getRay(i, j);
+
+					c += rayColor(r, max_depth_, world);
+				}
+
+				c *= (1.0f / samples_per_pixel_);
+				image_->set(i, j, toTGAColor(linearToGamma(c)));
+			}
+	}
+
 public:
 
 	int image_width_ = 100,
 		image_height_,
 		samples_per_pixel_ = 50,
-		max_depth_ = 50;
+		max_depth_ = 50,
+		thread_count_ = 0, // 0 uses every hardware thread
+		tile_size_ = 16, // in pixels
+		russian_roulette_depth_ = 3; // bounces before paths may be terminated early
 	double aspect_ratio_ = 1.0f,
 		vertical_fov_ = 90.0f, // in degrees
 		defocus_angle_ = 0.0f, // in degrees
-		focus_distance_ = 10.0f;
+		focus_distance_ = 10.0f,
+		russian_roulette_threshold_ = 0.5; // paths whose throughput drops below this play russian roulette
 	vec3 look_from_ = vec3(0, 0, 0),
 		look_at_ = vec3(0, 0, -1),
 		world_up_ = vec3(0, 1, 0);
-	vec3 background_color_;
+	Color background_color_;
+	bool sample_lights_ = true; // sample emissive spheres and quads directly at diffuse surfaces
+	bool filter_textures_ = true; // average image textures over the pixel footprint, off reads the finest level only
 	std::string image_path_ = "Export/image.tga";
 	TGAImage* image_ = nullptr;
 
 	void init()
 	{
 		image_height_ = image_width_ / aspect_ratio_;
-			image_height_ = (image_height_ < 1) ? 1 : image_height_,
-			y_iterator_.clear(),
-			y_iterator_.resize(image_height_),
-			x_iterator_.clear(),
-			x_iterator_.resize(image_width_);
-
-			for (unsigned int i = 0; i < image_height_; i++)
-				y_iterator_[i] = i;
-			for (unsigned int i = 0; i < image_width_; i++)
-				x_iterator_[i] = i;
+			image_height_ = (image_height_ < 1) ? 1 : image_height_;
 
 		double h = tan(DegreesToRadians(vertical_fov_ / 2.0f)) * focus_distance_,
 			disk_radius = focus_distance_ * tan(DegreesToRadians(defocus_angle_ / 2.0f)),
@@ -110,49 +192,27 @@ public:
 		delta_up_ = (1.0f / image_height_) * viewport_up_,
 		// we start from the bottom left of the viewport
 		pixel00_loc_ = camera_position_ - (focus_distance_ * front) + 0.5f * (-viewport_up_ - viewport_right_ + delta_right_ + delta_up_);
+
+		// the viewport is focus_distance_ away, one pixel there covers this angle; the jittered samples already
+		// average over the pixel, so the cone only has to cover the part of it a single sample stands for
+		double samples_scale = std::fmax(0.125, 1 / std::sqrt(double(samples_per_pixel_)));
+		pixel_spread_angle_ = filter_textures_ ? samples_scale * delta_up_.length() / focus_distance_ : 0;
 	}
 
 	void render(const Hittable& world) 
 	{
-#define MULTI_THREADS 0
+		lights_ = LightList();
+		if (sample_lights_)
+			lights_.build(world);
 
-#if MULTI_THREADS
+		// rows of the image differ a lot in cost, so the image is cut into tiles that idle threads steal from busy ones
+		TileScheduler scheduler(image_width_, image_height_, tile_size_, thread_count_);
 
-		std::for_each(std::execution::par, y_iterator_.begin(), y_iterator_.end(),
-			[this, &world](unsigned int j)
+		scheduler.run([this, &world](const TileScheduler::Tile& tile)
 			{
-				for (unsigned int i = 0; i < image_width_; i++)
-				{
-					Color c(0.0, 0.0, 0.0);
-
-					for (int sample = 0; sample < samples_per_pixel_; sample++) {
-
-						Ray r = getRay(i, j);
-
-						c += rayColor(r, max_depth_, world);
-					}
-
-					c *= (1.0f / samples_per_pixel_);
-					image_->set(i, j, toTGAColor(linearToGamma(c)));
-				}
+				renderTile(tile, world);
 			});
-#else
-		for (unsigned int j = 0; j < image_height_; j++)
-			for (unsigned int i = 0; i < image_width_; i++)
-			{
-				Color c(0.0, 0.0, 0.0);
-				
-				for (int sample = 0; sample < samples_per_pixel_; sample++) {
 
-					Ray r = getRay(i, j);
-
-					c += rayColor(r, max_depth_, world);
-				}
-				
-				c *= (1.0f / samples_per_pixel_);
-				image_->set(i, j, toTGAColor(linearToGamma(c)));
-			}
-#endif
 		image_->write_tga_file(image_path_);
 	}
 };
\ No newline at end of file
@@ -5,16 +5,24 @@
 #include "aabb.h"
 
 class Material;
+class Hittable;
 
+// hit() only fills in t_, object_ and the primitive's own parameters (u_, v_ for quads),
+// finalize() then works out the shading attributes once, for the closest hit
 class HitRecord {
 
 public:
 	bool front_face_;
 	double t_;
 	double u_, v_;
+	int primitive_index_ = 0; // which triangle of a mesh was hit
+	double uv_density_ = 0; // uv units per world unit around the hit, 0 where the primitive doesn't know
+	double footprint_ = 0; // width of the camera ray cone at the hit in uv units, set by the camera for texture filtering
+	const Hittable* object_ = nullptr; // the primitive that still has to finalize this record
 	vec3 intersection_point_;
 	vec3 normal_;
-	std::shared_ptr<Material> material_;
+	// the scene owns the materials (through its primitives), a plain pointer keeps refcount atomics off the hit path
+	const Material* material_ = nullptr;
 
 	void setNormal(const Ray& r, vec3 outward_normal) {
 
@@ -22,6 +30,17 @@ public:
 
 		normal_ = front_face_ ? outward_normal : -outward_normal;
 	}
+
+	void finalize(const Ray& r);
+};
+
+// a point picked on an emitter, pdf_ is with respect to solid angle as seen from the shading point
+class LightSample {
+
+public:
+	vec3 point_;
+	Color emission_;
+	double pdf_;
 };
 
 class Hittable {
@@ -33,8 +52,49 @@ public:
 	virtual bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const = 0;
 
 	virtual AABB getBoundingBox() const = 0;
+
+	// the boxes at the start (time 0) and the end (time 1) of the shutter, the box interpolated between them
+	// has to contain the object at any time in between; static objects return getBoundingBox() for both
+	virtual void getMotionBounds(AABB& start, AABB& end) const
+	{
+		start = end = getBoundingBox();
+	}
+
+	// fills in the shading attributes of a hit this primitive reported, see HitRecord
+	virtual void finalizeHit(const Ray& r, HitRecord& rec) const {}
+
+	// any hit in ray_t, for visibility tests: implementations stop at the first one and skip the shading attributes
+	virtual bool occluded(const Ray& r, Interval ray_t) const
+	{
+		HitRecord record;
+		return hit(r, ray_t, record);
+	}
+
+	// adds every emitter that can be sampled directly (see sampleLight) to lights
+	virtual void collectLights(std::vector<const Hittable*>& lights) const {}
+
+	virtual bool sampleLight(const vec3& origin, LightSample& sample) const
+	{
+		return false;
+	}
+
+	// the density sampleLight would have picked direction with, 0 when direction misses the emitter
+	virtual double lightPdf(const vec3& origin, const vec3& direction) const
+	{
+		return 0;
+	}
 };
 
+inline void HitRecord::finalize(const Ray& r)
+{
+	if (!object_)
+		return;
+	const Hittable* object = object_;
+	object_ = nullptr;
+	uv_density_ = 0;
+	object->finalizeHit(r, *this);
+}
+
 class Sphere : public Hittable {
 
 private:
@@ -43,6 +103,8 @@ private:
 	double radius_;
 	std::shared_ptr<Material> material_;
 	AABB bounding_box_;
+
+	friend class SoAScene; // copies the geometry into its arrays
 public:
 
 	Sphere(vec3 center, double radius, std::shared_ptr<Material> material) : center_(center, vec3(0, 0, 0)), radius_(std::fmax(0, radius)), material_(material)
@@ -71,7 +133,7 @@ public:
 		u = phi / (2 * Pi), v = theta / Pi;
 	}
 
-	bool hit(const Ray& r, Interval ray_t, HitRecord& record) const override
+	bool intersect(const Ray& r, Interval ray_t, double& t) const
 	{
 		// knowing where is the sphere at the time of intersection
 		vec3 current_center = center_.At(r.time_);
@@ -88,20 +150,49 @@ public:
 				return false;
 		}
 
-		record.t_ = ans;
-		record.intersection_point_ = r.At(ans);
-		vec3 normal = (record.intersection_point_ - current_center) / radius_;
-		record.setNormal(r, normal);
-		record.material_ = material_;
-		// normal is the representation of the intersection point but on the unit sphere
-		getSphereUV(normal, record.u_, record.v_);
+		t = ans;
+		return true;
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& record) const override
+	{
+		double t;
+		if (!intersect(r, ray_t, t))
+			return false;
+
+		record.t_ = t;
+		record.object_ = this;
 		return true;
 	}
 
+	// needs the complete Material, defined in material.h
+	void finalizeHit(const Ray& r, HitRecord& record) const override;
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		double t;
+		return intersect(r, ray_t, t);
+	}
+
+	// only static spheres are sampled, moving emitters are still found by the scattered rays
+	void collectLights(std::vector<const Hittable*>& lights) const override;
+
+	// uniform over the cone of directions the sphere covers, seen from origin
+	bool sampleLight(const vec3& origin, LightSample& sample) const override;
+
+	double lightPdf(const vec3& origin, const vec3& direction) const override;
+
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
 	}
+
+	void getMotionBounds(AABB& start, AABB& end) const override
+	{
+		vec3 radius_vector(radius_, radius_, radius_);
+		start = AABB(center_.At(0) - radius_vector, center_.At(0) + radius_vector);
+		end = AABB(center_.At(1) - radius_vector, center_.At(1) + radius_vector);
+	}
 };
 
 class Quad : public Hittable
@@ -111,9 +202,12 @@ class Quad : public Hittable
 	vec3 u_, v_;
 	vec3 normal_;
 	vec3 w_; // it helps with testing hits
+	double area_;
 	std::shared_ptr<Material> material_;
 	AABB bounding_box_;
 
+	friend class SoAScene;
+
 	void setBoundingBox()
 	{
 		bounding_box_ = AABB(corner_, corner_ + u_ + v_);
@@ -127,45 +221,68 @@ public:
 		vec3 normal = cross(u_, v_);
 		normal_ = normalize(normal);
 		w_ = normal / dot(normal, normal);
+		area_ = normal.length();
 		setBoundingBox();
 	}
 
-	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	bool intersect(const Ray& r, Interval ray_t, double& t, double& alpha, double& beta) const
 	{
 		double denominator = dot(normal_, r.dir_);
 		if (fabs(denominator) < 1e-8)
 			return false;
 
-		double t = dot(normal_, corner_ - r.orig_) / denominator;
+		t = dot(normal_, corner_ - r.orig_) / denominator;
 
 		if (!ray_t.contains(t))
 			return false;
 		vec3 intersection_vector = r.At(t) - corner_;
-		double alpha = dot(w_, cross(intersection_vector, v_));
-		double beta = dot(w_, cross(u_, intersection_vector));
+		alpha = dot(w_, cross(intersection_vector, v_));
+		beta = dot(w_, cross(u_, intersection_vector));
+
+		return isInside(alpha, beta);
+	}
 
-		if (!isInside(alpha, beta, rec))
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		double t, alpha, beta;
+		if (!intersect(r, ray_t, t, alpha, beta))
 			return false;
 
 		rec.t_ = t;
-		rec.intersection_point_ = intersection_vector + corner_;
-		rec.material_ = material_;
-		rec.setNormal(r, normal_);
+		rec.u_ = alpha;
+		rec.v_ = beta;
+		rec.object_ = this;
 
 		return true;
 	}
 
-	bool isInside(double alpha, double beta, HitRecord& rec) const
+	void finalizeHit(const Ray& r, HitRecord& rec) const override
 	{
-		Interval unit_interval(0, 1);
-		if (!unit_interval.contains(alpha) || !unit_interval.contains(beta))
-			return false;
+		rec.intersection_point_ = r.At(rec.t_);
+		rec.material_ = material_.get();
+		rec.setNormal(r, normal_);
+		rec.uv_density_ = 1 / std::sqrt(area_); // the unit square of uv covers the whole quad
+	}
 
-		rec.u_ = alpha;
-		rec.v_ = beta;
-		return true;
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		double t, alpha, beta;
+		return intersect(r, ray_t, t, alpha, beta);
 	}
 
+	bool isInside(double alpha, double beta) const
+	{
+		Interval unit_interval(0, 1);
+		return unit_interval.contains(alpha) && unit_interval.contains(beta);
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override;
+
+	// uniform over the area, converted to solid angle
+	bool sampleLight(const vec3& origin, LightSample& sample) const override;
+
+	double lightPdf(const vec3& origin, const vec3& direction) const override;
+
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
@@ -191,14 +308,28 @@ public:
 
 		if (!object_->hit(displaced_ray, ray_t, rec))
 			return false;
+		// the attributes are moved to world space here, so they can't wait for the closest hit
+		rec.finalize(displaced_ray);
 		rec.intersection_point_ += translation_;
 		return true;
 	}
 
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		return object_->occluded(Ray(r.orig_ - translation_, r.dir_, r.time_), ray_t);
+	}
+
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
 	}
+
+	void getMotionBounds(AABB& start, AABB& end) const override
+	{
+		object_->getMotionBounds(start, end);
+		start = start + translation_;
+		end = end + translation_;
+	}
 };
 
 class RotateY : public Hittable
@@ -224,8 +355,8 @@ public:
 			for (int j = 0; j < 2; j++)
 				for (int k = 0; k < 2; k++)
 				{
-					vec3 point(i * bounding_box_.x_.min_ + (i - 1) * bounding_box_.x_.max_,
-						j * bounding_box_.y_.min_ + (j - 1) * bounding_box_.y_.max_, k * bounding_box_.z_.min_ + (k - 1) * bounding_box_.z_.max_);
+					vec3 point(i * bounding_box_.x_.max_ + (1 - i) * bounding_box_.x_.min_,
+						j * bounding_box_.y_.max_ + (1 - j) * bounding_box_.y_.min_, k * bounding_box_.z_.max_ + (1 - k) * bounding_box_.z_.min_);
 
 					double temp = cosine_theta_ * point.x + sine_theta_ * point.z;
 					point.z = -sine_theta_ * point.x + cosine_theta_ * point.z;
@@ -234,7 +365,7 @@ public:
 					for (int i = 0; i < 3; i++)
 					{
 						mini.data[i] = min(mini.data[i], point.data[i]);
-						maxi.data[i] = min(maxi.data[i], point.data[i]);
+						maxi.data[i] = max(maxi.data[i], point.data[i]);
 					}
 				}
 		bounding_box_ = AABB(mini, maxi);
@@ -246,8 +377,10 @@ public:
 
 		vec3 new_direction(cosine_theta_ * r.dir_.x - sine_theta_ * r.dir_.z, r.dir_.y, sine_theta_ * r.dir_.x + cosine_theta_ * r.dir_.z);
 		
-		if (!object_->hit(Ray(new_origin, new_direction, r.time_), ray_t, rec))
+		Ray rotated_ray(new_origin, new_direction, r.time_);
+		if (!object_->hit(rotated_ray, ray_t, rec))
 			return false;
+		rec.finalize(rotated_ray);
 		
 		rec.intersection_point_ = vec3(cosine_theta_ * rec.intersection_point_.x + sine_theta_ * rec.intersection_point_.z, rec.intersection_point_.y, -sine_theta_ * rec.intersection_point_.x + cosine_theta_ * rec.intersection_point_.z);
 	
@@ -256,6 +389,15 @@ public:
 		return true;
 	}
 
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		vec3 new_origin(cosine_theta_ * r.orig_.x - sine_theta_ * r.orig_.z, r.orig_.y, sine_theta_ * r.orig_.x + cosine_theta_ * r.orig_.z);
+
+		vec3 new_direction(cosine_theta_ * r.dir_.x - sine_theta_ * r.dir_.z, r.dir_.y, sine_theta_ * r.dir_.x + cosine_theta_ * r.dir_.z);
+
+		return object_->occluded(Ray(new_origin, new_direction, r.time_), ray_t);
+	}
+
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
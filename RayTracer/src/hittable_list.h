@@ -34,24 +34,49 @@ public:
 
 		bool hit = false;
 		double closest_t = ray_t.max_;
-		HitRecord temp_record;
+		// objects only write the record when they hit closer than closest_t, so no temporary copy is needed
 		for (const auto& obj : objects_) {
-			if (obj->hit(r, Interval(ray_t.min_, closest_t), temp_record)) {
+			if (obj->hit(r, Interval(ray_t.min_, closest_t), record)) {
 
 				hit = true;
-				closest_t = temp_record.t_;
-				record = temp_record;
+				closest_t = record.t_;
 			}
 		}
 
 		return hit;
 	}
 
+	bool occluded(const Ray& r, Interval ray_t) const override {
+
+		for (const auto& obj : objects_)
+			if (obj->occluded(r, ray_t))
+				return true;
+		return false;
+	}
+
 
 	AABB getBoundingBox() const override
 	{
 		return bounding_box_;
 	}
+
+	void getMotionBounds(AABB& start, AABB& end) const override
+	{
+		start = end = AABB::Empty;
+		for (const auto& obj : objects_)
+		{
+			AABB object_start, object_end;
+			obj->getMotionBounds(object_start, object_end);
+			start = AABB(start, object_start);
+			end = AABB(end, object_end);
+		}
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		for (const auto& obj : objects_)
+			obj->collectLights(lights);
+	}
 };
 
 inline std::shared_ptr<HittableList> Box(const vec3& a, const vec3& b, std::shared_ptr<Material> material)
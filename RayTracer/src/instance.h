@@ -0,0 +1,80 @@
+#pragma once
+
+#include "hittable.h"
+#include "transform.h"
+
+// places a shared bottom level structure (a BVH, a mesh, a box) in the world; a BVH over instances
+// is the top level, so a thousand copies cost one BLAS in memory and each ray is transformed once per instance
+class Instance : public Hittable
+{
+
+	std::shared_ptr<Hittable> object_;
+	Transform object_to_world_;
+	Transform world_to_object_;
+	AABB bounding_box_;
+
+public:
+
+	Instance(std::shared_ptr<Hittable> object, const Transform& object_to_world)
+		: object_(object), object_to_world_(object_to_world), world_to_object_(object_to_world.inverse())
+	{
+		bounding_box_ = object_to_world_.box(object_->getBoundingBox());
+	}
+
+	// nested transforms are folded into one matrix instead of adding a wrapper layer
+	Instance(std::shared_ptr<Instance> instance, const Transform& transform)
+		: Instance(instance->object_, transform * instance->object_to_world_)
+	{
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		// the direction isn't normalized, so t is the same in both spaces
+		Ray local_ray(world_to_object_.point(r.orig_), world_to_object_.vector(r.dir_), r.time_);
+		if (!object_->hit(local_ray, ray_t, rec))
+			return false;
+
+		// the attributes are moved to world space here, so they can't wait for the closest hit
+		rec.finalize(local_ray);
+		rec.intersection_point_ = object_to_world_.point(rec.intersection_point_);
+		// the side of the surface doesn't change, dot(normal, direction) keeps its sign under the inverse transpose
+		vec3 normal = world_to_object_.normalFromInverse(rec.normal_);
+		// the surface around the hit grows by |det| * |normal| (Nanson's formula), its uv density by the square root of that
+		if (rec.uv_density_ > 0)
+			rec.uv_density_ /= std::sqrt(fabs(object_to_world_.determinant()) * normal.length());
+		rec.normal_ = normalize(normal);
+		return true;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		return object_->occluded(Ray(world_to_object_.point(r.orig_), world_to_object_.vector(r.dir_), r.time_), ray_t);
+	}
+
+	// emitters inside instances are left to the scattered rays, light sampling works in world space only
+
+	AABB getBoundingBox() const override
+	{
+		return bounding_box_;
+	}
+
+	void getMotionBounds(AABB& start, AABB& end) const override
+	{
+		object_->getMotionBounds(start, end);
+		start = object_to_world_.box(start);
+		end = object_to_world_.box(end);
+	}
+
+	// moves the instance, a BVH holding it has to be refit afterwards (see LinearBVH::update)
+	void setTransform(const Transform& object_to_world)
+	{
+		object_to_world_ = object_to_world;
+		world_to_object_ = object_to_world.inverse();
+		bounding_box_ = object_to_world_.box(object_->getBoundingBox());
+	}
+
+	const Transform& getTransform() const
+	{
+		return object_to_world_;
+	}
+};
@@ -2,63 +2,74 @@
 
 #include "utility.h"
 
-class Interval {
+template <typename T>
+class IntervalT {
 
 public:
-	double min_, max_;
+	using Scalar = T;
 
-	Interval() : min_(Infinity), max_(-Infinity) {}
-	Interval(double min, double max) : min_(min), max_(max) {}
+	T min_, max_;
 
-	double size() const 
+	IntervalT() : min_(T(Infinity)), max_(T(-Infinity)) {}
+	IntervalT(T min, T max) : min_(min), max_(max) {}
+
+	T size() const
 	{
 		return max_ - min_;
 	}
 
-	bool contains(double v) const 
+	bool contains(T v) const
 	{
 		return v >= min_ && v <= max_;
 	}
 
-	bool surrounds(double v) const
+	bool surrounds(T v) const
 	{
 		return v > min_ && v < max_;
 	}
-	
-	double clamp(double v) const
+
+	T clamp(T v) const
 	{
 		if (v < min_) return min_;
 		if (v > max_) return max_;
 		return v;
 	}
 
-	Interval expand(double delta)
+	IntervalT expand(T delta)
 	{
-		double padding = delta / 2;
-		return Interval(min_ - padding, max_ + padding);
+		T padding = delta / 2;
+		return IntervalT(min_ - padding, max_ + padding);
 	}
-	static const Interval Empty, Universe;
+	static const IntervalT Empty, Universe;
 };
 
-Interval intersect(const Interval& a, const Interval& b)
+template <typename T>
+IntervalT<T> intersect(const IntervalT<T>& a, const IntervalT<T>& b)
 {
-	return Interval(max(a.min_, b.min_), min(a.max_, b.max_));
+	return IntervalT<T>(max(a.min_, b.min_), min(a.max_, b.max_));
 }
 
-Interval unite(const Interval& a, const Interval& b)
+template <typename T>
+IntervalT<T> unite(const IntervalT<T>& a, const IntervalT<T>& b)
 {
-	return Interval(min(a.min_, b.min_), max(a.max_, b.max_));;
+	return IntervalT<T>(min(a.min_, b.min_), max(a.max_, b.max_));;
 }
 
-Interval operator+(const Interval& a, const double& offset)
+template <typename T>
+IntervalT<T> operator+(const IntervalT<T>& a, const typename IntervalT<T>::Scalar& offset)
 {
-	return Interval(a.min_ + offset, a.max_ + offset);
+	return IntervalT<T>(a.min_ + offset, a.max_ + offset);
 }
 
-Interval operator+(const double& offset, const Interval& a)
+template <typename T>
+IntervalT<T> operator+(const typename IntervalT<T>::Scalar& offset, const IntervalT<T>& a)
 {
 	return a + offset;
 }
 
-const Interval Interval::Empty;
-const Interval Interval::Universe(-Infinity, Infinity);
\ No newline at end of file
+template <typename T>
+const IntervalT<T> IntervalT<T>::Empty;
+template <typename T>
+const IntervalT<T> IntervalT<T>::Universe(T(-Infinity), T(Infinity));
+
+using Interval = IntervalT<Real>;
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "hittable.h"
+#include "material.h"
+
+// the emitter sampling of the primitives lives here since it needs the complete Material
+
+inline void Sphere::collectLights(std::vector<const Hittable*>& lights) const
+{
+	if (material_->isEmissive() && center_.dir_.nearZero())
+		lights.push_back(this);
+}
+
+inline bool Sphere::sampleLight(const vec3& origin, LightSample& sample) const
+{
+	vec3 to_center = center_.orig_ - origin;
+	double distance2 = to_center.length2();
+	if (distance2 <= radius_ * radius_)
+		return false;
+
+	double distance = sqrt(distance2), cos_theta_max = sqrt(1 - radius_ * radius_ / distance2);
+	double cos_theta = 1 + RandomDouble() * (cos_theta_max - 1), sin_theta = sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+	double phi = 2 * Pi * RandomDouble();
+
+	vec3 w = to_center / distance;
+	vec3 a = (fabs(w.x) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+	vec3 v = normalize(cross(w, a)), u = cross(w, v);
+	vec3 direction = cos(phi) * sin_theta * u + sin(phi) * sin_theta * v + cos_theta * w;
+
+	// distance to the near side of the sphere along the sampled direction
+	double t = distance * cos_theta - sqrt(std::fmax(0.0, radius_ * radius_ - distance2 * sin_theta * sin_theta));
+	sample.point_ = origin + t * direction;
+	vec3 normal = (sample.point_ - center_.orig_) / radius_;
+	double u_coordinate, v_coordinate;
+	getSphereUV(normal, u_coordinate, v_coordinate);
+	sample.emission_ = material_->emit(u_coordinate, v_coordinate, sample.point_);
+	sample.pdf_ = 1 / (2 * Pi * (1 - cos_theta_max));
+	return true;
+}
+
+inline double Sphere::lightPdf(const vec3& origin, const vec3& direction) const
+{
+	HitRecord record;
+	if (!hit(Ray(origin, direction), Interval(RayOffset(origin), Infinity), record))
+		return 0;
+
+	double distance2 = (center_.orig_ - origin).length2();
+	if (distance2 <= radius_ * radius_)
+		return 0;
+	double cos_theta_max = sqrt(1 - radius_ * radius_ / distance2);
+	return 1 / (2 * Pi * (1 - cos_theta_max));
+}
+
+inline void Quad::collectLights(std::vector<const Hittable*>& lights) const
+{
+	if (material_->isEmissive())
+		lights.push_back(this);
+}
+
+inline bool Quad::sampleLight(const vec3& origin, LightSample& sample) const
+{
+	double alpha = RandomDouble(), beta = RandomDouble();
+	sample.point_ = corner_ + alpha * u_ + beta * v_;
+
+	vec3 direction = sample.point_ - origin;
+	double distance2 = direction.length2();
+	double cosine = fabs(dot(direction, normal_)) / sqrt(distance2);
+	if (cosine < 1e-8)
+		return false;
+
+	sample.emission_ = material_->emit(alpha, beta, sample.point_);
+	sample.pdf_ = distance2 / (cosine * area_);
+	return true;
+}
+
+inline double Quad::lightPdf(const vec3& origin, const vec3& direction) const
+{
+	HitRecord record;
+	if (!hit(Ray(origin, direction), Interval(RayOffset(origin), Infinity), record))
+		return 0;
+
+	double distance2 = record.t_ * record.t_ * direction.length2();
+	double cosine = fabs(dot(direction, normal_)) / direction.length();
+	return distance2 / (cosine * area_);
+}
+
+// every directly sampled emitter of a scene, one of them is picked uniformly per sample
+class LightList
+{
+
+	std::vector<const Hittable*> lights_;
+
+public:
+
+	void build(const Hittable& world)
+	{
+		lights_.clear();
+		world.collectLights(lights_);
+	}
+
+	bool empty() const
+	{
+		return lights_.empty();
+	}
+
+	bool sample(const vec3& origin, LightSample& sample) const
+	{
+		if (lights_.empty())
+			return false;
+
+		size_t index = size_t(RandomDouble() * lights_.size());
+		index = (index < lights_.size()) ? index : lights_.size() - 1;
+		if (!lights_[index]->sampleLight(origin, sample))
+			return false;
+		// only the picked light's density: the shadow ray stops at its point, so lights behind it along the
+		// same direction couldn't have contributed, and lights in front of it occlude the sample
+		sample.pdf_ /= lights_.size();
+		return sample.pdf_ > 0;
+	}
+
+	// the density of sampling the direction towards light, the emitter a scattered ray actually hit;
+	// 0 when that emitter isn't in the list
+	double pdf(const Hittable* light, const vec3& origin, const vec3& direction) const
+	{
+		if (!light || std::find(lights_.begin(), lights_.end(), light) == lights_.end())
+			return 0;
+		return light->lightPdf(origin, direction) / lights_.size();
+	}
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// 32 bytes, two nodes per cache line
+struct alignas(32) LinearBVHNode
+{
+	float bounds_[2][3]; // [min / max][axis], indexed by the ray's sign bits
+	int32_t offset_; // interior nodes: index of the second child (the first one directly follows), leaves: first primitive
+	uint16_t primitive_count_; // 0 for interior nodes
+	uint8_t axis_;
+	uint8_t padding_;
+
+	// rounding outwards keeps the float box conservative
+	void setBounds(const AABB& box)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lower = float(box.data_[axis].min_), upper = float(box.data_[axis].max_);
+			bounds_[0][axis] = (lower > box.data_[axis].min_) ? std::nextafter(lower, -std::numeric_limits<float>::infinity()) : lower;
+			bounds_[1][axis] = (upper < box.data_[axis].max_) ? std::nextafter(upper, std::numeric_limits<float>::infinity()) : upper;
+		}
+	}
+
+	// the same branchless slab test as AABB::hit
+	bool hit(const Ray& r, double t_min, double t_max) const
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double t_enter = (bounds_[r.sign_[axis]][axis] - r.orig_.data[axis]) * r.inverse_dir_.data[axis];
+			double t_leave = (bounds_[1 - r.sign_[axis]][axis] - r.orig_.data[axis]) * r.inverse_dir_.data[axis] * SlabSlack;
+			t_min = (t_enter > t_min) ? t_enter : t_min;
+			t_max = (t_leave < t_max) ? t_leave : t_max;
+		}
+		return t_min <= t_max;
+	}
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fill half a cache line");
+
+// the BVH as one array of nodes in depth first order, traversed with a loop and a small stack
+class LinearBVH : public Hittable
+{
+
+	static const int stack_size_ = 64;
+
+	std::vector<LinearBVHNode> nodes_;
+	std::vector<std::shared_ptr<Hittable>> primitives_; // in leaf order, owns the objects
+	std::vector<const Hittable*> primitive_pointers_; // in leaf order, what traversal reads
+	AABB bounding_box_;
+	BVHStatistics statistics_;
+	BVHBuildOptions options_;
+
+	// what refit and update need on top of the traversal data, indexed by node
+	std::vector<int32_t> parents_; // -1 for the root
+	std::vector<int32_t> subtree_sizes_; // nodes reserved for the subtree, a rebuilt subtree has to fit in them
+	std::vector<int32_t> first_primitives_, primitive_counts_; // the primitive range every subtree covers
+	std::vector<double> costs_, built_costs_; // SAH cost of every subtree, now and when it was last built
+	// indexed by primitive slot
+	std::vector<int32_t> primitive_leaves_;
+	std::unordered_map<const Hittable*, int32_t> primitive_slots_;
+	// scratch space of update(), kept so a frame doesn't allocate
+	std::vector<int32_t> dirty_nodes_;
+	std::vector<uint8_t> dirty_;
+
+	AABB nodeBox(int index) const
+	{
+		const LinearBVHNode& node = nodes_[index];
+		return AABB(Interval(node.bounds_[0][0], node.bounds_[1][0]), Interval(node.bounds_[0][1], node.bounds_[1][1]), Interval(node.bounds_[0][2], node.bounds_[1][2]));
+	}
+
+	// unnormalized, only ever compared with the cost of the same node
+	double nodeCost(int index) const
+	{
+		const LinearBVHNode& node = nodes_[index];
+		double area = nodeBox(index).surfaceArea();
+		if (node.primitive_count_ > 0)
+			return area * options_.intersection_cost_ * node.primitive_count_;
+		return area * options_.traversal_cost_ + costs_[index + 1] + costs_[node.offset_];
+	}
+
+	void refitNode(int index)
+	{
+		LinearBVHNode& node = nodes_[index];
+		AABB box = AABB::Empty;
+		if (node.primitive_count_ > 0)
+		{
+			for (int i = 0; i < node.primitive_count_; i++)
+				box = AABB(box, primitive_pointers_[node.offset_ + i]->getBoundingBox());
+		}
+		else
+			box = AABB(nodeBox(index + 1), nodeBox(node.offset_));
+		node.setBounds(box);
+		costs_[index] = nodeCost(index);
+	}
+
+	void refitSubtree(int index)
+	{
+		if (nodes_[index].primitive_count_ == 0)
+		{
+			refitSubtree(index + 1);
+			refitSubtree(nodes_[index].offset_);
+		}
+		refitNode(index);
+	}
+
+	// writes the builder's tree over objects to the nodes starting at node_base and the primitive slots starting at primitive_base
+	void flatten(const BVHBuilder& builder, const std::vector<std::shared_ptr<Hittable>>& objects, int node_base, int primitive_base, int parent)
+	{
+		const std::vector<BVHBuildNode>& build_nodes = builder.getNodes();
+		const std::vector<int>& order = builder.getPrimitiveOrder();
+
+		for (size_t i = 0; i < build_nodes.size(); i++)
+		{
+			const BVHBuildNode& build_node = build_nodes[i];
+			int index = node_base + int(i);
+			LinearBVHNode& node = nodes_[index];
+			node.setBounds(build_node.bounding_box_);
+			// the builder already stores nodes depth first with the left child right after its parent
+			node.offset_ = build_node.isLeaf() ? primitive_base + build_node.first_primitive_ : node_base + build_node.right_;
+			node.primitive_count_ = build_node.isLeaf() ? uint16_t(build_node.primitive_count_) : 0;
+			node.axis_ = uint8_t(build_node.axis_);
+			node.padding_ = 0;
+
+			first_primitives_[index] = primitive_base + build_node.first_primitive_;
+			primitive_counts_[index] = build_node.primitive_count_;
+			if (i == 0)
+				parents_[index] = parent;
+			if (!build_node.isLeaf())
+				parents_[node_base + build_node.left_] = parents_[node_base + build_node.right_] = index;
+			for (int k = 0; build_node.isLeaf() && k < build_node.primitive_count_; k++)
+				primitive_leaves_[primitive_base + build_node.first_primitive_ + k] = index;
+		}
+
+		for (size_t i = build_nodes.size(); i-- > 0;)
+		{
+			const BVHBuildNode& build_node = build_nodes[i];
+			int index = node_base + int(i);
+			subtree_sizes_[index] = build_node.isLeaf() ? 1 : 1 + subtree_sizes_[node_base + build_node.left_] + subtree_sizes_[node_base + build_node.right_];
+			costs_[index] = built_costs_[index] = nodeCost(index);
+		}
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			int slot = primitive_base + int(i);
+			primitives_[slot] = objects[order[i]];
+			primitive_pointers_[slot] = primitives_[slot].get();
+			primitive_slots_[primitive_pointers_[slot]] = slot;
+		}
+	}
+
+	void build(std::vector<std::shared_ptr<Hittable>> objects)
+	{
+		std::vector<AABB> bounds;
+		bounds.reserve(objects.size());
+		for (const auto& object : objects)
+			bounds.push_back(object->getBoundingBox());
+
+		BVHBuildOptions options = options_;
+		BVHBuilder builder(bounds, options);
+		if (builder.getStatistics().depth_ > stack_size_)
+		{ // a median split is balanced, so its depth is bounded by log2 of the primitive count
+			options.method_ = BVHBuildOptions::Method::Median;
+			builder = BVHBuilder(bounds, options);
+		}
+
+		size_t node_count = builder.getNodes().size();
+		nodes_.resize(node_count);
+		parents_.resize(node_count);
+		subtree_sizes_.resize(node_count);
+		first_primitives_.resize(node_count);
+		primitive_counts_.resize(node_count);
+		costs_.resize(node_count);
+		built_costs_.resize(node_count);
+		dirty_.assign(node_count, 0);
+		primitives_.resize(objects.size());
+		primitive_pointers_.resize(objects.size());
+		primitive_leaves_.resize(objects.size());
+		primitive_slots_.clear();
+
+		flatten(builder, objects, 0, 0, -1);
+		bounding_box_ = builder.getNodes()[0].bounding_box_;
+		statistics_ = builder.getStatistics();
+	}
+
+	// rebuilds the subtree over the primitives it already covers, false when the new tree doesn't fit in its nodes
+	bool rebuildSubtree(int index)
+	{
+		int first = first_primitives_[index], count = primitive_counts_[index];
+		std::vector<std::shared_ptr<Hittable>> objects(primitives_.begin() + first, primitives_.begin() + first + count);
+		std::vector<AABB> bounds;
+		bounds.reserve(count);
+		for (const auto& object : objects)
+			bounds.push_back(object->getBoundingBox());
+
+		BVHBuilder builder(bounds, options_);
+		int depth = 0;
+		for (int parent = parents_[index]; parent >= 0; parent = parents_[parent])
+			depth++;
+		int reserved = subtree_sizes_[index];
+		if (int(builder.getNodes().size()) > reserved || depth + builder.getStatistics().depth_ > stack_size_)
+			return false;
+
+		// nodes left over at the end of the reserved range are simply not referenced any more
+		flatten(builder, objects, index, first, parents_[index]);
+		subtree_sizes_[index] = reserved;
+		return true;
+	}
+
+public:
+
+	LinearBVH(const HittableList& list, BVHBuildOptions options = BVHBuildOptions()) : options_(options)
+	{
+		build(list.objects_);
+	}
+
+	// recomputes every box bottom up after objects moved, in O(n); the tree itself stays the same
+	void refit()
+	{
+		if (primitive_pointers_.empty())
+			return;
+		refitSubtree(0);
+		bounding_box_ = nodeBox(0);
+	}
+
+	// refits only the paths from the moved objects to the root, then rebuilds the topmost subtrees
+	// whose SAH cost grew past rebuild_threshold times their cost when they were built;
+	// returns the number of rebuilt subtrees
+	int update(const std::vector<const Hittable*>& moved, double rebuild_threshold = 1.5)
+	{
+		dirty_nodes_.clear();
+		for (const Hittable* object : moved)
+		{
+			auto slot = primitive_slots_.find(object);
+			if (slot == primitive_slots_.end())
+				continue;
+			for (int node = primitive_leaves_[slot->second]; node >= 0 && !dirty_[node]; node = parents_[node])
+			{
+				dirty_[node] = 1;
+				dirty_nodes_.push_back(node);
+			}
+		}
+
+		// children always have larger indices than their parent
+		std::sort(dirty_nodes_.begin(), dirty_nodes_.end(), std::greater<int32_t>());
+		for (int32_t node : dirty_nodes_)
+		{
+			refitNode(node);
+			dirty_[node] = 0;
+		}
+
+		// top down, a subtree is contiguous from its root, so everything below a rebuilt root is skipped
+		int rebuilt = 0;
+		int32_t skip_begin = 0, skip_end = 0;
+		for (auto node = dirty_nodes_.rbegin(); node != dirty_nodes_.rend(); ++node)
+		{
+			if (*node >= skip_begin && *node < skip_end)
+				continue;
+			if (primitive_counts_[*node] < 2 || costs_[*node] <= rebuild_threshold * built_costs_[*node])
+				continue;
+
+			if (!rebuildSubtree(*node))
+			{
+				build(primitives_);
+				return rebuilt + 1;
+			}
+			rebuilt++;
+			skip_begin = *node, skip_end = *node + subtree_sizes_[*node];
+			// the root box of the subtree is the same, only the costs above it change
+			for (int parent = parents_[*node]; parent >= 0; parent = parents_[parent])
+				costs_[parent] = nodeCost(parent);
+		}
+
+		bounding_box_ = nodeBox(0);
+		return rebuilt;
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+		bool hit_anything = false;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ > 0)
+				{
+					for (int i = 0; i < node.primitive_count_; i++)
+						if (primitive_pointers_[node.offset_ + i]->hit(r, ray_t, rec))
+						{
+							hit_anything = true;
+							ray_t.max_ = rec.t_;
+						}
+				}
+				else
+				{ // visit the child on the near side of the split first, the far one waits on the stack
+					if (r.sign_[node.axis_])
+					{
+						stack[stack_top++] = node_index + 1;
+						node_index = node.offset_;
+					}
+					else
+					{
+						stack[stack_top++] = node.offset_;
+						node_index = node_index + 1;
+					}
+					continue;
+				}
+			}
+
+			if (stack_top == 0)
+				break;
+			node_index = stack[--stack_top];
+		}
+
+		return hit_anything;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ == 0)
+				{ // any hit ends the query, so the child order doesn't matter
+					stack[stack_top++] = node.offset_;
+					node_index = node_index + 1;
+					continue;
+				}
+				for (int i = 0; i < node.primitive_count_; i++)
+					if (primitive_pointers_[node.offset_ + i]->occluded(r, ray_t))
+						return true;
+			}
+
+			if (stack_top == 0)
+				return false;
+			node_index = stack[--stack_top];
+		}
+	}
+
+	AABB getBoundingBox() const override
+	{
+		return bounding_box_;
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		for (const Hittable* primitive : primitive_pointers_)
+			primitive->collectLights(lights);
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+};
@@ -1,13 +1,128 @@
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "soa_scene.h"
+#include "mesh_loader.h"
+#include "instance.h"
+#include "motion_bvh.h"
+#include "animation.h"
+#include "scene_arena.h"
+#include <chrono>
 #include "material.h"
 #include "camera.h"
 
+// the structures bouncingSpheres can be rendered through, compared by acceleratorBenchmark
+enum class Accelerator { SoA, Wide4, Wide8 };
+
+void bouncingSpheres(Accelerator accelerator)
+{
+    SceneArena arena; // declared first so it outlives everything made from it
+    HittableList world;
+
+    auto checker = arena.make<CheckerTexture>(0.32, arena.make<SolidTexture>(Color(.2, .3, .1)), arena.make<SolidTexture>(Color(.9, .9, .9)));
+    world.add(arena.make<Sphere>(vec3(0, -1000, 0), 1000, arena.make<Lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = RandomDouble();
+            vec3 center(a + 0.9 * RandomDouble(), 0.2, b + 0.9 * RandomDouble());
+
+            if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
+                std::shared_ptr<Material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    Color albedo = Color::random() * Color::random();
+                    sphere_material = arena.make<Lambertian>(arena.make<SolidTexture>(albedo));
+                    world.add(arena.make<Sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    Color albedo = Color::random(0.5, 1);
+                    double fuzz = RandomDouble(0, 0.5);
+                    sphere_material = arena.make<Metal>(albedo, fuzz);
+                    world.add(arena.make<Sphere>(center, 0.2, sphere_material));
+                }
+                else {
+                    // glass
+                    sphere_material = arena.make<Dielectric>(1.5);
+                    world.add(arena.make<Sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = arena.make<Dielectric>(1.5);
+    world.add(arena.make<Sphere>(vec3(0, 1, 0), 1.0, material1));
+
+    auto material2 = arena.make<Lambertian>(arena.make<SolidTexture>(Color(0.4, 0.2, 0.1)));
+    world.add(arena.make<Sphere>(vec3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = arena.make<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<Sphere>(vec3(4, 1, 0), 1.0, material3));
+
+    Camera cam;
+
+    cam.aspect_ratio_ = 16.0 / 9.0;
+    cam.image_width_ = 400;
+    cam.samples_per_pixel_ = 100;
+    cam.max_depth_ = 50;
+    cam.background_color_ = Color(0.70, 0.80, 1.00);
+
+    cam.vertical_fov_ = 20;
+    cam.look_from_ = vec3(13, 2, 3);
+    cam.look_at_ = vec3(0, 0, 0);
+    cam.world_up_ = vec3(0, 1, 0);
+
+    cam.defocus_angle_ = 0.6;
+    cam.focus_distance_ = 10.0;
+    cam.init();
+    cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
+
+    if (accelerator == Accelerator::SoA)
+    {
+        // the spheres live in SoA arrays, leaves test 4 of them at once
+        auto scene = arena.make<SoAScene>(world);
+        scene->getStatistics().print(std::cout);
+        cam.render(*scene);
+        return;
+    }
+
+    // MakeWideBVH falls back to 4 children when the cpu has no AVX2
+    BVHStatistics statistics;
+    auto bvh = MakeWideBVH(world, BVHBuildOptions(), (accelerator == Accelerator::Wide4) ? 4 : 8, &statistics);
+    statistics.print(std::cout);
+    cam.render(*bvh);
+}
+
 void bouncingSpheres()
 {
+    bouncingSpheres(Accelerator::SoA);
+}
+
+// times bouncingSpheres through the SoA leaves and both wide BVHs, the images are the same
+void acceleratorBenchmark()
+{
+    struct BenchmarkAccelerator { const char* name_; Accelerator accelerator_; };
+    const BenchmarkAccelerator accelerators[] = {
+        { "SoA scene", Accelerator::SoA }, { "4-wide BVH", Accelerator::Wide4 }, { "8-wide BVH", Accelerator::Wide8 } };
+
+    for (const BenchmarkAccelerator& accelerator : accelerators) {
+        auto start = std::chrono::steady_clock::now();
+        bouncingSpheres(accelerator.accelerator_);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << accelerator.name_ << ": " << seconds << "s\n";
+    }
+}
+
+// bouncingSpheres with the diffuse spheres moving up during the shutter, rendered through a motion BVH
+void movingSpheres()
+{
+    SceneArena arena; // declared first so it outlives everything made from it
     HittableList world;
 
-    auto checker = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
-    world.add(std::make_shared<Sphere>(vec3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+    auto checker = arena.make<CheckerTexture>(0.32, arena.make<SolidTexture>(Color(.2, .3, .1)), arena.make<SolidTexture>(Color(.9, .9, .9)));
+    world.add(arena.make<Sphere>(vec3(0, -1000, 0), 1000, arena.make<Lambertian>(checker)));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -19,34 +134,35 @@ void bouncingSpheres()
 
                 if (choose_mat < 0.8) {
                     // diffuse
-                    Color albedo = Vec3::random() * Vec3::random();
-                    sphere_material = std::make_shared<Lambertian>(albedo);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    Color albedo = Color::random() * Color::random();
+                    sphere_material = arena.make<Lambertian>(arena.make<SolidTexture>(albedo));
+                    vec3 final_center = center + vec3(0, RandomDouble(0, 0.5), 0);
+                    world.add(arena.make<Sphere>(center, final_center, 0.2, sphere_material));
                 }
                 else if (choose_mat < 0.95) {
                     // metal
-                    Color albedo = Vec3::random(0.5, 1);
+                    Color albedo = Color::random(0.5, 1);
                     double fuzz = RandomDouble(0, 0.5);
-                    sphere_material = std::make_shared<Metal>(albedo, fuzz);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<Metal>(albedo, fuzz);
+                    world.add(arena.make<Sphere>(center, 0.2, sphere_material));
                 }
                 else {
                     // glass
-                    sphere_material = std::make_shared<Dielectric>(1.5);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<Dielectric>(1.5);
+                    world.add(arena.make<Sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = std::make_shared<Dielectric>(1.5);
-    world.add(std::make_shared<Sphere>(vec3(0, 1, 0), 1.0, material1));
+    auto material1 = arena.make<Dielectric>(1.5);
+    world.add(arena.make<Sphere>(vec3(0, 1, 0), 1.0, material1));
 
-    auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<Sphere>(vec3(-4, 1, 0), 1.0, material2));
+    auto material2 = arena.make<Lambertian>(arena.make<SolidTexture>(Color(0.4, 0.2, 0.1)));
+    world.add(arena.make<Sphere>(vec3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<Sphere>(vec3(4, 1, 0), 1.0, material3));
+    auto material3 = arena.make<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<Sphere>(vec3(4, 1, 0), 1.0, material3));
 
     Camera cam;
 
@@ -66,9 +182,9 @@ void bouncingSpheres()
     cam.init();
     cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
 
-    BVHNode node(world);
-    //world = HittableList(std::make_shared<BVHNode>(world));
-    cam.render(node);
+    MotionBVH bvh(world);
+    bvh.getStatistics().print(std::cout);
+    cam.render(bvh);
 }
 
 void checkeredSpheres()
@@ -101,11 +217,10 @@ void checkeredSpheres()
     cam.render(world);
 }
 
-void earth()
+void earth(std::shared_ptr<Texture> earth_texture)
 {
     HittableList world;
 
-    auto earth_texture = std::make_shared<ImageTexture>("res/earthmap.tga");
     auto earth_surface = std::make_shared<Lambertian>(earth_texture);
     world.add(std::make_shared<Sphere>(vec3(0, 0, 0), 2, earth_surface));
 
@@ -130,12 +245,30 @@ void earth()
     cam.render(world);
 }
 
-void noiseSpheres()
+void earth()
+{
+    earth(std::make_shared<ImageTexture>("res/earthmap.tga"));
+}
+
+// the earth map read through a texture cache whose budget holds only a part of its tiles, so the
+// statistics show the misses and evictions of a scene whose textures don't fit in memory
+void cachedEarth()
+{
+    TextureCacheOptions options;
+    options.memory_budget_ = size_t(1) << 20;
+    auto cache = std::make_shared<TextureCache>(options);
+    earth(std::make_shared<CachedImageTexture>(cache, "res/earthmap.tga"));
+    cache->getStatistics().print(std::cout);
+}
+
+// with bake_options the texture reads its turbulence from a baked grid
+void noiseSpheres(const NoiseVolumeOptions* bake_options)
 {
     HittableList world;
     auto value_noise = std::make_shared<ValueNoise>(256);
     auto perlin_noise = std::make_shared<PerlinNoise>(256);
     auto noise_texture = std::make_shared<NoiseTexture>(perlin_noise, 4);
+    const NoiseVolume* volume = bake_options ? &noise_texture->bake(*bake_options) : nullptr;
     world.add(std::make_shared<Sphere>(vec3(0, -1000, 0), 1000, std::make_shared<Lambertian>(noise_texture)));
     world.add(std::make_shared<Sphere>(vec3(0, 2, 0), 2, std::make_shared<Lambertian>(noise_texture)));
 
@@ -158,6 +291,26 @@ void noiseSpheres()
     cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
 
     cam.render(world);
+    if (volume)
+        volume->getStatistics().print(std::cout);
+}
+
+void noiseSpheres()
+{
+    noiseSpheres(nullptr);
+}
+
+// the noise spheres with the turbulence baked brick by brick as the render reaches it, only the bricks
+// around the two surfaces are ever computed; the box holds the small sphere and the ground around it,
+// the ground farther away evaluates the noise
+void bakedNoiseSpheres()
+{
+    NoiseVolumeOptions options;
+    options.resolution_ = 384;
+    options.origin_ = vec3(-12, -1, -12);
+    options.extent_ = 24;
+    options.lazy_ = true;
+    noiseSpheres(&options);
 }
 
 void quads()
@@ -249,15 +402,12 @@ void cornellBox()
     world.add(std::make_shared<Quad>(vec3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
     world.add(std::make_shared<Quad>(vec3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-    std::shared_ptr<Hittable> box1 = Box(vec3(0, 0, 0), vec3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    std::shared_ptr<Hittable> box2 = Box(vec3(0, 0, 0), vec3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
+    // both boxes are instances of one unit box
+    auto unit_box = std::make_shared<LinearBVH>(*Box(vec3(0, 0, 0), vec3(1, 1, 1), white));
+    world.add(std::make_shared<Instance>(unit_box,
+        Transform::Translation(vec3(265, 0, 295)) * Transform::RotationY(15) * Transform::Scale(vec3(165, 330, 165))));
+    world.add(std::make_shared<Instance>(unit_box,
+        Transform::Translation(vec3(130, 0, 65)) * Transform::RotationY(-18) * Transform::Scale(vec3(165, 165, 165))));
 
     Camera cam;
 
@@ -277,13 +427,265 @@ void cornellBox()
     cam.init();
     cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
 
+    LinearBVH scene(world);
+    cam.render(scene);
+}
+
+void triangleMesh()
+{
+    HittableList world;
+
+    auto checker = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
+    world.add(std::make_shared<Sphere>(vec3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+
+    auto start = std::chrono::steady_clock::now();
+    auto mesh = LoadMesh("res/icosphere.obj", std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1)));
+    if (mesh)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded " << mesh->triangleCount() << " triangles in " << seconds << "s\n";
+        mesh->getStatistics().print(std::cout);
+        world.add(std::make_shared<Translate>(mesh, vec3(0, 1, 0)));
+    }
+
+    auto difflight = std::make_shared<DiffuseLight>(Color(4, 4, 4));
+    world.add(std::make_shared<Quad>(vec3(-2, 4, -2), vec3(4, 0, 0), vec3(0, 0, 4), difflight));
+
+    Camera cam;
+
+    cam.aspect_ratio_ = 16.0 / 9.0;
+    cam.image_width_ = 400;
+    cam.samples_per_pixel_ = 100;
+    cam.max_depth_ = 50;
+    cam.background_color_ = Color(0.10, 0.10, 0.12);
+
+    cam.vertical_fov_ = 30;
+    cam.look_from_ = vec3(8, 3, 3);
+    cam.look_at_ = vec3(0, 1, 0);
+    cam.world_up_ = vec3(0, 1, 0);
+
+    cam.defocus_angle_ = 0.0;
+    cam.focus_distance_ = 10.0;
+    cam.init();
+    cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
+
     cam.render(world);
 }
 
+// the PLY loader has to read the s t and texture_u texture_v aliases of u v, both quads carry u = x and v = y;
+// false when a fixture is missing or reads back wrong
+bool meshLoaderChecks()
+{
+    const char* paths[] = { "res/quad_st.ply", "res/quad_texture_uv.ply" };
+    const bool normals[] = { false, true };
+    bool passed = true;
+    for (int i = 0; i < 2; i++)
+    {
+        MeshData mesh;
+        if (!LoadPLY(paths[i], mesh))
+        {
+            std::cerr << paths[i] << " : couldn't be loaded\n";
+            passed = false;
+            continue;
+        }
+        bool ok = mesh.triangleCount() == 2 && mesh.uvs_.size() == 2 * mesh.positions_.size() && mesh.normals_.empty() != normals[i];
+        for (size_t v = 0; ok && v < mesh.positions_.size(); v++)
+            ok = mesh.positions_[v].z == 0.5 && mesh.uvs_[2 * v] == mesh.positions_[v].x && mesh.uvs_[2 * v + 1] == mesh.positions_[v].y;
+        if (ok)
+            std::cout << paths[i] << " : ok\n";
+        else
+            std::cerr << paths[i] << " : wrong positions, normals or uvs\n";
+        passed = passed && ok;
+    }
+    return passed;
+}
+
+// a MotionBVH over spheres moving every which way, and some static ones, has to nest its boxes at both shutter ends
+bool motionBVHChecks()
+{
+    HittableList world;
+    auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    for (int i = 0; i < 2000; i++) {
+        vec3 center(RandomDouble(-20, 20), RandomDouble(0, 5), RandomDouble(-20, 20));
+        vec3 motion = (i % 4 == 0) ? vec3(0, 0, 0) : vec3(RandomDouble(-2, 2), RandomDouble(-2, 2), RandomDouble(-2, 2));
+        world.add(std::make_shared<Sphere>(center, center + motion, RandomDouble(0.05, 0.5), material));
+    }
+
+    MotionBVH bvh(world);
+    bool passed = bvh.boundsNested();
+    if (passed)
+        std::cout << "MotionBVH node boxes : ok\n";
+    else
+        std::cerr << "MotionBVH node boxes : a box doesn't contain its children\n";
+    return passed;
+}
+
+// the checks that don't render, scene 0 exits with 1 when one of them fails
+bool checks()
+{
+    bool passed = meshLoaderChecks();
+    passed = motionBVHChecks() && passed;
+    return passed;
+}
+
+// a turntable of three instanced boxes over a static field of spheres, written as a frame sequence
+void spinningBoxes()
+{
+    SceneArena arena; // declared first so it outlives everything made from it
+    HittableList world;
+
+    auto checker = arena.make<CheckerTexture>(0.32, arena.make<SolidTexture>(Color(.2, .3, .1)), arena.make<SolidTexture>(Color(.9, .9, .9)));
+    world.add(arena.make<Sphere>(vec3(0, -1000, 0), 1000, arena.make<Lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            vec3 center(a + 0.9 * RandomDouble(), 0.2, b + 0.9 * RandomDouble());
+            if (fabs(center.z) > 1.5)
+                world.add(arena.make<Sphere>(center, 0.2, arena.make<Lambertian>(arena.make<SolidTexture>(Color::random() * Color::random()))));
+        }
+    }
+
+    // the boxes share one BLAS, every frame only changes their transforms
+    auto metal = arena.make<Metal>(Color(0.7, 0.6, 0.5), 0.1);
+    auto unit_box = arena.make<LinearBVH>(*Box(vec3(-0.5, 0, -0.5), vec3(0.5, 1.5, 0.5), metal));
+    std::vector<std::shared_ptr<Instance>> boxes;
+    for (int i = 0; i < 3; i++) {
+        boxes.push_back(arena.make<Instance>(unit_box, Transform::Translation(vec3(3.0 * (i - 1), 0, 0))));
+        world.add(boxes.back());
+    }
+
+    Camera cam;
+
+    cam.aspect_ratio_ = 16.0 / 9.0;
+    cam.image_width_ = 400;
+    cam.samples_per_pixel_ = 50;
+    cam.max_depth_ = 50;
+    cam.background_color_ = Color(0.70, 0.80, 1.00);
+
+    cam.vertical_fov_ = 25;
+    cam.look_from_ = vec3(2, 3, 12);
+    cam.look_at_ = vec3(0, 0.5, 0);
+    cam.world_up_ = vec3(0, 1, 0);
+
+    cam.defocus_angle_ = 0.0;
+    cam.focus_distance_ = 10.0;
+    cam.init();
+    cam.image_ = new TGAImage(cam.image_width_, cam.image_height_, TGAImage::RGB);
+
+    LinearBVH bvh(world);
+    RenderAnimation(cam, bvh, 24, [&boxes](int frame, std::vector<const Hittable*>& moved) {
+        for (int i = 0; i < 3; i++) {
+            boxes[i]->setTransform(Transform::Translation(vec3(3.0 * (i - 1), 0, 0)) * Transform::RotationY(frame * 15.0 * (i + 1)));
+            moved.push_back(boxes[i].get());
+        }
+    });
+}
+
+// renders the existing scenes one after the other and times them, build with and without RAYTRACER_FLOAT to compare the precisions
+void precisionBenchmark()
+{
+    struct BenchmarkScene { const char* name_; void (*render_)(); };
+    const BenchmarkScene scenes[] = {
+        { "bouncing spheres", bouncingSpheres }, { "earth", earth }, { "noise spheres", noiseSpheres },
+        { "cornell box", cornellBox }, { "triangle mesh", triangleMesh }, { "moving spheres", movingSpheres } };
+
+    std::cout << "Geometry in " << ((sizeof(Real) == sizeof(float)) ? "float" : "double") << '\n';
+    double total = 0;
+    for (const BenchmarkScene& scene : scenes) {
+        auto start = std::chrono::steady_clock::now();
+        scene.render_();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << scene.name_ << ": " << seconds << "s\n";
+        total += seconds;
+    }
+    std::cout << "total: " << total << "s\n";
+}
+
+// times bilinear footprints (2x2 texel fetches) in each texel format and layout, against the linear colors in
+// 8 bit image rows that ImageTexture used to keep; once at random positions and once walking 8x8 pixel tiles over
+// the image turned by 90 degrees, so a step to the next pixel moves down a column. the earth map is timed as it is
+// and repeated 8x8 times, which is larger than the caches
+void textureBenchmark(const TGAImage& source, int repeat)
+{
+    int width = source.width() * repeat, height = source.height() * repeat;
+    auto get_linear = [&source](int x, int y) { return gammaToLinear(toColor(source.get(x % source.width(), y % source.height()))); };
+
+    struct Position { int column_, row_; };
+    const int lookup_count = 1 << 22;
+    std::vector<Position> random_positions(lookup_count), coherent_positions;
+    for (Position& position : random_positions)
+        position = { RandomInteger(0, width - 2), RandomInteger(0, height - 2) };
+    int side = (width < height) ? width - 1 : height - 1;
+    side -= side % 8;
+    while (int(coherent_positions.size()) < lookup_count)
+        for (int tile_y = 0; tile_y < side && int(coherent_positions.size()) < lookup_count; tile_y += 8)
+            for (int tile_x = 0; tile_x < side; tile_x += 8)
+                for (int y = tile_y; y < tile_y + 8; y++)
+                    for (int x = tile_x; x < tile_x + 8; x++)
+                        coherent_positions.push_back({ y, x });
+
+    auto time = [](auto fetch, const std::vector<Position>& positions) {
+        Color sum(0, 0, 0);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookup_count; i++) {
+            const Position& p = positions[i];
+            sum += fetch(p.column_, p.row_) + fetch(p.column_ + 1, p.row_) + fetch(p.column_, p.row_ + 1) + fetch(p.column_ + 1, p.row_ + 1);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (sum.x < 0) // keeps the loop from being optimized away
+            std::cout << sum << '\n';
+        return seconds * 1e9 / lookup_count;
+    };
+    auto report = [](const char* name, size_t bytes, double random_ns, double coherent_ns) {
+        char line[160];
+        snprintf(line, sizeof(line), "%-14s %8.2fMB  random %6.1fns  coherent %6.1fns\n", name, bytes / double(1 << 20), random_ns, coherent_ns);
+        std::cout << line;
+    };
+
+    std::cout << width << "x" << height << ":\n";
+    {
+        TGAImage bytes(width, height, TGAImage::RGB);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                bytes.set(x, y, toTGAColor(get_linear(x, y)));
+
+        auto fetch = [&bytes](int x, int y) { return toColor(bytes.get(x, y)); };
+        report("8 bit rows", size_t(width) * height * 3, time(fetch, random_positions), time(fetch, coherent_positions));
+    }
+
+    struct Variant { const char* name_; TexelFormat format_; TexelLayout layout_; };
+    const Variant variants[] = {
+        { "float rows", TexelFormat::Float32, TexelLayout::RowMajor }, { "float tiles", TexelFormat::Float32, TexelLayout::Tiled },
+        { "half rows", TexelFormat::Half, TexelLayout::RowMajor }, { "half tiles", TexelFormat::Half, TexelLayout::Tiled } };
+    for (const Variant& variant : variants) {
+        TexelStorage storage(width, height, variant.format_, variant.layout_);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                storage.set(x, y, get_linear(x, y));
+
+        auto fetch = [&storage](int x, int y) { return storage.get(x, y); };
+        report(variant.name_, storage.getByteSize(), time(fetch, random_positions), time(fetch, coherent_positions));
+    }
+}
+
+void textureBenchmark()
+{
+    TGAImage image;
+    if (!image.read_tga_file("res/earthmap.tga")) {
+        std::cerr << "Couldn't load res/earthmap.tga\n";
+        return;
+    }
+    image.flip_vertically();
+    textureBenchmark(image, 1);
+    textureBenchmark(image, 8);
+}
+
 int main() {
 
     switch (3)
     {
+    case 0:
+        return checks() ? 0 : 1;
     case 1:
         bouncingSpheres();
         break;
@@ -305,6 +707,30 @@ int main() {
     case 7:
         cornellBox();
         break;
+    case 8:
+        triangleMesh();
+        break;
+    case 9:
+        movingSpheres();
+        break;
+    case 10:
+        spinningBoxes();
+        break;
+    case 11:
+        precisionBenchmark();
+        break;
+    case 12:
+        bakedNoiseSpheres();
+        break;
+    case 13:
+        textureBenchmark();
+        break;
+    case 14:
+        cachedEarth();
+        break;
+    case 15:
+        acceleratorBenchmark();
+        break;
     }
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "utility.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// a read only view of a whole file, the pages are loaded by the os as they are touched
+class MappedFile
+{
+
+public:
+
+	enum class Access { Sequential, Random }; // a hint for how far ahead the os reads
+
+private:
+
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#endif
+
+public:
+
+	explicit MappedFile(const char* path, Access access = Access::Sequential)
+	{
+#ifdef _WIN32
+		file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			(access == Access::Sequential) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+			return;
+		mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_)
+			return;
+		data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+		size_ = data_ ? size_t(size.QuadPart) : 0;
+#else
+		int file = open(path, O_RDONLY);
+		if (file < 0)
+			return;
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			void* mapping = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapping != MAP_FAILED)
+			{
+				data_ = static_cast<const char*>(mapping);
+				size_ = size_t(status.st_size);
+				madvise(mapping, size_, (access == Access::Sequential) ? MADV_SEQUENTIAL : MADV_RANDOM);
+			}
+		}
+		close(file); // the mapping keeps the file alive
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (mapping_)
+			CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+#else
+		if (data_)
+			munmap(const_cast<char*>(data_), size_);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const
+	{
+		return data_ != nullptr;
+	}
+
+	const char* begin() const
+	{
+		return data_;
+	}
+
+	const char* end() const
+	{
+		return data_ + size_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+};
+
+// when the file was last written, in units of the os; false when it doesn't exist
+inline bool GetModificationTime(const char* path, long long& time)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+		return false;
+	time = ((long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat status;
+	if (stat(path, &status) != 0)
+		return false;
+	time = (long long)status.st_mtime;
+#endif
+	return true;
+}
@@ -18,6 +18,29 @@ public:
 
 			return false;
 		}
+
+		virtual bool isEmissive() const
+		{
+			return false;
+		}
+
+		// diffuse materials get light sampling, the others (mirrors, glass) only see lights through their scattered ray
+		virtual bool isDiffuse() const
+		{
+			return false;
+		}
+
+		// whether shading reads the u, v coordinates, primitives skip computing them otherwise
+		virtual bool needsUV() const
+		{
+			return false;
+		}
+
+		// the density scatter() picks direction with; for diffuse materials attenuation * scatteringPdf is the brdf times cosine
+		virtual double scatteringPdf(const Ray& r_in, const HitRecord& record, const vec3& direction) const
+		{
+			return 0;
+		}
 };
 
 class Lambertian : public Material
@@ -38,10 +61,27 @@ public:
 			scatter_direction = record.normal_;
 
 		scattered = Ray(record.intersection_point_, scatter_direction, r_in.time_);
-		attenuation = texture_->getValue(record.u_, record.v_, record.intersection_point_);
+		attenuation = texture_->getFilteredValue(record.u_, record.v_, record.intersection_point_, record.footprint_);
 
 		return true;
 	}
+
+	bool isDiffuse() const override
+	{
+		return true;
+	}
+
+	bool needsUV() const override
+	{
+		return texture_->usesUV();
+	}
+
+	// normal + random unit vector is cosine distributed around the normal
+	double scatteringPdf(const Ray& r_in, const HitRecord& record, const vec3& direction) const override
+	{
+		double cosine = dot(record.normal_, direction) / direction.length();
+		return (cosine > 0) ? cosine / Pi : 0;
+	}
 };
 
 class Metal : public Material
@@ -110,11 +150,41 @@ public:
 
 	DiffuseLight(std::shared_ptr<Texture> texture) : texture_(texture) {}
 
-	DiffuseLight(const vec3& color) : texture_(std::make_shared<SolidTexture>(color)) {}
+	DiffuseLight(const Color& color) : texture_(std::make_shared<SolidTexture>(color)) {}
 
 	Color emit(double u, double v, const vec3& point) const override
 	{
 		return texture_->getValue(u, v, point);
 	}
 
-};
\ No newline at end of file
+	bool isEmissive() const override
+	{
+		return true;
+	}
+
+	bool needsUV() const override
+	{
+		return texture_->usesUV();
+	}
+
+};
+
+inline void Sphere::finalizeHit(const Ray& r, HitRecord& record) const
+{
+	vec3 current_center = center_.At(r.time_);
+	record.intersection_point_ = r.At(record.t_);
+	vec3 normal = (record.intersection_point_ - current_center) / radius_;
+	record.setNormal(r, normal);
+	record.material_ = material_.get();
+	// normal is the representation of the intersection point but on the unit sphere
+	if (material_->needsUV())
+	{
+		getSphereUV(normal, record.u_, record.v_);
+		// u runs around a circle of radius r sin(theta) and v over half of a great circle, the density is
+		// the geometric mean of the two and grows towards the poles where u is squeezed
+		double sine_theta = std::sqrt(std::fmax(1e-6, 1 - normal.y * normal.y));
+		record.uv_density_ = 1 / (Pi * radius_ * std::sqrt(2 * sine_theta));
+	}
+	else
+		record.u_ = record.v_ = 0;
+}
\ No newline at end of file
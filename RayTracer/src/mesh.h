@@ -0,0 +1,305 @@
+#pragma once
+
+#include "linear_bvh.h"
+
+// the buffers of an indexed triangle mesh, filled by the loaders in mesh_loader.h;
+// normals and uvs are optional and have their own indices (as in OBJ files), -1 means the corner has none
+struct MeshData
+{
+	std::vector<vec3> positions_;
+	std::vector<vec3> normals_;
+	std::vector<double> uvs_; // u, v pairs
+	std::vector<int32_t> position_indices_; // 3 per triangle
+	std::vector<int32_t> normal_indices_; // empty or 3 per triangle
+	std::vector<int32_t> uv_indices_; // empty or 3 per triangle
+
+	size_t triangleCount() const
+	{
+		return position_indices_.size() / 3;
+	}
+};
+
+// the ray sheared so its direction becomes +z, shared by every triangle test of a traversal
+// (Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection"); edges are evaluated the same way
+// from both triangles sharing them, so rays can't slip through the cracks of a closed mesh
+struct WatertightRay
+{
+	int kx_, ky_, kz_;
+	double shear_x_, shear_y_, shear_z_;
+
+	WatertightRay(const Ray& r)
+	{
+		vec3 magnitude(fabs(r.dir_.x), fabs(r.dir_.y), fabs(r.dir_.z));
+		kz_ = (magnitude.x > magnitude.y) ? ((magnitude.x > magnitude.z) ? 0 : 2) : ((magnitude.y > magnitude.z) ? 1 : 2);
+		kx_ = (kz_ + 1) % 3;
+		ky_ = (kx_ + 1) % 3;
+		// keeps the winding, and so the sign of the edge functions, independent of the direction
+		if (r.dir_.data[kz_] < 0)
+			std::swap(kx_, ky_);
+
+		shear_x_ = r.dir_.data[kx_] / r.dir_.data[kz_];
+		shear_y_ = r.dir_.data[ky_] / r.dir_.data[kz_];
+		shear_z_ = 1.0 / r.dir_.data[kz_];
+	}
+};
+
+// an indexed triangle mesh with its own BVH over the triangles, the scene BVH sees it as one primitive
+class TriangleMesh : public Hittable
+{
+
+	static const int stack_size_ = 64;
+
+	MeshData data_; // the triangles are stored in leaf order
+	std::vector<LinearBVHNode> nodes_;
+	std::shared_ptr<Material> material_;
+	AABB bounding_box_;
+	BVHStatistics statistics_;
+
+	// returns the barycentric coordinates of the second and third corner in b1 and b2
+	bool intersect(int triangle, const Ray& r, const WatertightRay& sheared, Interval ray_t, double& t, double& b1, double& b2) const
+	{
+		const int32_t* index = &data_.position_indices_[3 * triangle];
+		vec3 a = data_.positions_[index[0]] - r.orig_, b = data_.positions_[index[1]] - r.orig_, c = data_.positions_[index[2]] - r.orig_;
+
+		double ax = a.data[sheared.kx_] - sheared.shear_x_ * a.data[sheared.kz_], ay = a.data[sheared.ky_] - sheared.shear_y_ * a.data[sheared.kz_];
+		double bx = b.data[sheared.kx_] - sheared.shear_x_ * b.data[sheared.kz_], by = b.data[sheared.ky_] - sheared.shear_y_ * b.data[sheared.kz_];
+		double cx = c.data[sheared.kx_] - sheared.shear_x_ * c.data[sheared.kz_], cy = c.data[sheared.ky_] - sheared.shear_y_ * c.data[sheared.kz_];
+
+		// scaled barycentrics, the ray passes inside when they all have the same sign
+		double u = cx * by - cy * bx, v = ax * cy - ay * cx, w = bx * ay - by * ax;
+		if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+			return false;
+		double determinant = u + v + w;
+		if (determinant == 0)
+			return false;
+
+		double scaled_t = u * sheared.shear_z_ * a.data[sheared.kz_] + v * sheared.shear_z_ * b.data[sheared.kz_] + w * sheared.shear_z_ * c.data[sheared.kz_];
+		t = scaled_t / determinant;
+		if (!ray_t.surrounds(t))
+			return false;
+
+		b1 = v / determinant;
+		b2 = w / determinant;
+		return true;
+	}
+
+	std::vector<AABB> triangleBounds() const
+	{
+		std::vector<AABB> bounds(data_.triangleCount());
+		for (size_t i = 0; i < bounds.size(); i++)
+		{
+			const int32_t* index = &data_.position_indices_[3 * i];
+			bounds[i] = AABB(AABB(data_.positions_[index[0]], data_.positions_[index[1]]), AABB(data_.positions_[index[2]], data_.positions_[index[2]]));
+		}
+		return bounds;
+	}
+
+	// reorders the triangles (and their optional indices) into the builder's leaf order
+	void reorder(const std::vector<int>& order)
+	{
+		auto permute = [&order](std::vector<int32_t>& indices)
+			{
+				if (indices.empty())
+					return;
+				std::vector<int32_t> sorted(indices.size());
+				for (size_t i = 0; i < order.size(); i++)
+					for (int k = 0; k < 3; k++)
+						sorted[3 * i + k] = indices[3 * size_t(order[i]) + k];
+				indices.swap(sorted);
+			};
+		permute(data_.position_indices_);
+		permute(data_.normal_indices_);
+		permute(data_.uv_indices_);
+	}
+
+public:
+
+	TriangleMesh(MeshData data, std::shared_ptr<Material> material, BVHBuildOptions options = BVHBuildOptions())
+		: data_(std::move(data)), material_(material)
+	{
+		if (!data_.triangleCount())
+			return;
+
+		options.max_leaf_size_ = (options.max_leaf_size_ > 65535) ? 65535 : options.max_leaf_size_;
+		BVHBuilder builder(triangleBounds(), options);
+		if (builder.getStatistics().depth_ > stack_size_)
+		{
+			options.method_ = BVHBuildOptions::Method::Median;
+			builder = BVHBuilder(triangleBounds(), options);
+		}
+
+		const std::vector<BVHBuildNode>& build_nodes = builder.getNodes();
+		nodes_.resize(build_nodes.size());
+		for (size_t i = 0; i < build_nodes.size(); i++)
+		{
+			const BVHBuildNode& build_node = build_nodes[i];
+			LinearBVHNode& node = nodes_[i];
+			node.setBounds(build_node.bounding_box_);
+			node.offset_ = build_node.isLeaf() ? build_node.first_primitive_ : build_node.right_;
+			node.primitive_count_ = build_node.isLeaf() ? uint16_t(build_node.primitive_count_) : 0;
+			node.axis_ = uint8_t(build_node.axis_);
+			node.padding_ = 0;
+		}
+		reorder(builder.getPrimitiveOrder());
+
+		bounding_box_ = build_nodes[0].bounding_box_;
+		statistics_ = builder.getStatistics();
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		if (nodes_.empty())
+			return false;
+
+		WatertightRay sheared(r);
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+		bool hit_anything = false;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ > 0)
+				{
+					for (int i = 0; i < node.primitive_count_; i++)
+					{
+						double t, b1, b2;
+						if (intersect(node.offset_ + i, r, sheared, ray_t, t, b1, b2))
+						{
+							rec.t_ = ray_t.max_ = t;
+							rec.u_ = b1;
+							rec.v_ = b2;
+							rec.primitive_index_ = node.offset_ + i;
+							rec.object_ = this;
+							hit_anything = true;
+						}
+					}
+				}
+				else
+				{
+					if (r.sign_[node.axis_])
+					{
+						stack[stack_top++] = node_index + 1;
+						node_index = node.offset_;
+					}
+					else
+					{
+						stack[stack_top++] = node.offset_;
+						node_index = node_index + 1;
+					}
+					continue;
+				}
+			}
+
+			if (stack_top == 0)
+				break;
+			node_index = stack[--stack_top];
+		}
+
+		return hit_anything;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (nodes_.empty())
+			return false;
+
+		WatertightRay sheared(r);
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ == 0)
+				{
+					stack[stack_top++] = node.offset_;
+					node_index = node_index + 1;
+					continue;
+				}
+				for (int i = 0; i < node.primitive_count_; i++)
+				{
+					double t, b1, b2;
+					if (intersect(node.offset_ + i, r, sheared, ray_t, t, b1, b2))
+						return true;
+				}
+			}
+
+			if (stack_top == 0)
+				return false;
+			node_index = stack[--stack_top];
+		}
+	}
+
+	// the shading normal and uv are interpolated from the corners that have them,
+	// the geometric normal decides which side the ray came from
+	void finalizeHit(const Ray& r, HitRecord& rec) const override
+	{
+		int triangle = rec.primitive_index_;
+		double b1 = rec.u_, b2 = rec.v_, b0 = 1 - b1 - b2;
+		const int32_t* index = &data_.position_indices_[3 * triangle];
+		const vec3& p0 = data_.positions_[index[0]];
+		const vec3& p1 = data_.positions_[index[1]];
+		const vec3& p2 = data_.positions_[index[2]];
+
+		rec.intersection_point_ = b0 * p0 + b1 * p1 + b2 * p2;
+		rec.material_ = material_.get();
+		vec3 edge_cross = cross(p1 - p0, p2 - p0);
+		vec3 geometric_normal = normalize(edge_cross);
+
+		vec3 shading_normal = geometric_normal;
+		if (!data_.normal_indices_.empty())
+		{
+			const int32_t* normal_index = &data_.normal_indices_[3 * triangle];
+			if (normal_index[0] >= 0 && normal_index[1] >= 0 && normal_index[2] >= 0)
+			{
+				vec3 interpolated = b0 * data_.normals_[normal_index[0]] + b1 * data_.normals_[normal_index[1]] + b2 * data_.normals_[normal_index[2]];
+				if (interpolated.length2() > 0)
+					shading_normal = normalize(interpolated);
+			}
+		}
+		// the vertex normals say where the outside is, whatever the winding of the triangle
+		if (dot(geometric_normal, shading_normal) < 0)
+			geometric_normal = -geometric_normal;
+		rec.setNormal(r, geometric_normal);
+		rec.normal_ = rec.front_face_ ? shading_normal : -shading_normal;
+
+		// without uvs the barycentrics are the texture coordinates, like alpha and beta of a quad
+		rec.u_ = b1, rec.v_ = b2;
+		double uv_area = 1; // twice the area of the triangle in uv, as the world area below
+		if (!data_.uv_indices_.empty())
+		{
+			const int32_t* uv_index = &data_.uv_indices_[3 * triangle];
+			if (uv_index[0] >= 0 && uv_index[1] >= 0 && uv_index[2] >= 0)
+			{
+				const double* uv0 = &data_.uvs_[2 * uv_index[0]];
+				const double* uv1 = &data_.uvs_[2 * uv_index[1]];
+				const double* uv2 = &data_.uvs_[2 * uv_index[2]];
+				rec.u_ = b0 * uv0[0] + b1 * uv1[0] + b2 * uv2[0];
+				rec.v_ = b0 * uv0[1] + b1 * uv1[1] + b2 * uv2[1];
+				uv_area = fabs((uv1[0] - uv0[0]) * (uv2[1] - uv0[1]) - (uv2[0] - uv0[0]) * (uv1[1] - uv0[1]));
+			}
+		}
+		double world_area = edge_cross.length();
+		rec.uv_density_ = (world_area > 0) ? std::sqrt(uv_area / world_area) : 0;
+	}
+
+	AABB getBoundingBox() const override
+	{
+		return bounding_box_;
+	}
+
+	size_t triangleCount() const
+	{
+		return data_.triangleCount();
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+};
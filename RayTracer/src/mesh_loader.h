@@ -0,0 +1,469 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "mesh.h"
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// the text parsing helpers work on [p, end) of the mapped file and never allocate
+namespace MeshParsing
+{
+	inline void SkipSpaces(const char*& p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+	}
+
+	inline void SkipLine(const char*& p, const char* end)
+	{
+		const char* newline = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+		p = newline ? newline + 1 : end;
+	}
+
+	inline bool AtLineEnd(const char* p, const char* end)
+	{
+		return p >= end || *p == '\n' || *p == '#';
+	}
+
+	// true when the line continues with keyword followed by a space
+	inline bool StartsWith(const char* p, const char* end, const char* keyword)
+	{
+		size_t length = strlen(keyword);
+		return size_t(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+	}
+
+	// float or double, whichever the value is
+	template <typename T>
+	inline bool ParseReal(const char*& p, const char* end, T& value)
+	{
+		SkipSpaces(p, end);
+		if (p < end && *p == '+') // from_chars only accepts a minus sign
+			p++;
+		std::from_chars_result result = std::from_chars(p, end, value);
+		if (result.ec != std::errc())
+			return false;
+		p = result.ptr;
+		return true;
+	}
+
+	inline bool ParseInt(const char*& p, const char* end, long long& value)
+	{
+		if (p < end && *p == '+')
+			p++;
+		std::from_chars_result result = std::from_chars(p, end, value);
+		if (result.ec != std::errc())
+			return false;
+		p = result.ptr;
+		return true;
+	}
+
+	inline void SkipToken(const char*& p, const char* end)
+	{
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+			p++;
+	}
+}
+
+// OBJ indices start at 1, negative ones count back from the last element defined so far
+inline bool ResolveOBJIndex(long long index, size_t defined, int32_t& resolved)
+{
+	long long value = (index < 0) ? (long long)defined + index : index - 1;
+	if (index == 0 || value < 0 || value >= (long long)defined)
+		return false;
+	resolved = int32_t(value);
+	return true;
+}
+
+// v, vt, vn and f statements, polygons are split into fans; everything else (groups, materials) is ignored
+inline bool LoadOBJ(const char* path, MeshData& mesh)
+{
+	using namespace MeshParsing;
+
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		std::cerr << "Couldn't open the mesh with path : " << path << '\n';
+		return false;
+	}
+
+	// a first pass only counts, so every buffer is allocated once with its final size
+	size_t position_count = 0, normal_count = 0, uv_count = 0, triangle_count = 0;
+	for (const char* p = file.begin(); p < file.end(); SkipLine(p, file.end()))
+	{
+		SkipSpaces(p, file.end());
+		if (StartsWith(p, file.end(), "v"))
+			position_count++;
+		else if (StartsWith(p, file.end(), "vn"))
+			normal_count++;
+		else if (StartsWith(p, file.end(), "vt"))
+			uv_count++;
+		else if (StartsWith(p, file.end(), "f"))
+		{
+			p++;
+			int corners = 0;
+			for (SkipSpaces(p, file.end()); !AtLineEnd(p, file.end()); SkipSpaces(p, file.end()))
+				SkipToken(p, file.end()), corners++;
+			triangle_count += (corners > 2) ? corners - 2 : 0;
+		}
+	}
+
+	mesh = MeshData();
+	mesh.positions_.reserve(position_count);
+	mesh.normals_.reserve(normal_count);
+	mesh.uvs_.reserve(2 * uv_count);
+	mesh.position_indices_.reserve(3 * triangle_count);
+	if (normal_count)
+		mesh.normal_indices_.reserve(3 * triangle_count);
+	if (uv_count)
+		mesh.uv_indices_.reserve(3 * triangle_count);
+
+	int line = 1;
+	for (const char* p = file.begin(); p < file.end(); SkipLine(p, file.end()), line++)
+	{
+		SkipSpaces(p, file.end());
+		bool valid = true;
+		if (StartsWith(p, file.end(), "v") || StartsWith(p, file.end(), "vn"))
+		{
+			bool normal = p[1] == 'n';
+			p += normal ? 2 : 1;
+			vec3 value;
+			for (int axis = 0; axis < 3 && valid; axis++)
+				valid = ParseReal(p, file.end(), value.data[axis]);
+			(normal ? mesh.normals_ : mesh.positions_).push_back(value);
+		}
+		else if (StartsWith(p, file.end(), "vt"))
+		{
+			p += 2;
+			double u = 0, v = 0;
+			valid = ParseReal(p, file.end(), u);
+			ParseReal(p, file.end(), v); // v is optional
+			mesh.uvs_.push_back(u);
+			mesh.uvs_.push_back(v);
+		}
+		else if (StartsWith(p, file.end(), "f"))
+		{
+			p++;
+			// position, uv and normal index of the fan's first and previous corner
+			int32_t first[3] = {}, previous[3] = {};
+			int corner = 0;
+			for (SkipSpaces(p, file.end()); !AtLineEnd(p, file.end()) && valid; SkipSpaces(p, file.end()), corner++)
+			{
+				int32_t current[3] = { -1, -1, -1 };
+				long long index;
+				valid = ParseInt(p, file.end(), index) && ResolveOBJIndex(index, mesh.positions_.size(), current[0]);
+				if (valid && p < file.end() && *p == '/')
+				{
+					p++;
+					if (p < file.end() && *p != '/')
+						valid = ParseInt(p, file.end(), index) && ResolveOBJIndex(index, mesh.uvs_.size() / 2, current[1]);
+					if (valid && p < file.end() && *p == '/')
+					{
+						p++;
+						valid = ParseInt(p, file.end(), index) && ResolveOBJIndex(index, mesh.normals_.size(), current[2]);
+					}
+				}
+				if (!valid)
+					break;
+
+				if (corner == 0)
+					memcpy(first, current, sizeof(first));
+				else if (corner >= 2)
+				{
+					const int32_t* triangle[3] = { first, previous, current };
+					for (int k = 0; k < 3; k++)
+					{
+						mesh.position_indices_.push_back(triangle[k][0]);
+						if (uv_count)
+							mesh.uv_indices_.push_back(triangle[k][1]);
+						if (normal_count)
+							mesh.normal_indices_.push_back(triangle[k][2]);
+					}
+				}
+				memcpy(previous, current, sizeof(previous));
+			}
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Couldn't parse line " << line << " of the mesh with path : " << path << '\n';
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// binary PLY in either byte order, with x y z, optional nx ny nz and u v (or s t) vertex properties
+// and a vertex_indices list per face; other elements and properties are read and skipped
+inline bool LoadPLY(const char* path, MeshData& mesh)
+{
+	using namespace MeshParsing;
+
+	enum class Type { Invalid, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+	struct Property
+	{
+		Type type_ = Type::Invalid, count_type_ = Type::Invalid; // count_type_ is set for lists
+		int target_ = -1; // vertex: 0..7 for x y z nx ny nz u v, face: 0 for the index list
+	};
+	struct Element
+	{
+		bool vertex_ = false, face_ = false;
+		size_t count_ = 0;
+		std::vector<Property> properties_;
+	};
+
+	auto parseType = [](const char* p, const char* end) -> Type
+		{
+			const char* token_end = p;
+			SkipToken(token_end, end);
+			std::string_view name(p, size_t(token_end - p));
+			if (name == "char" || name == "int8") return Type::Int8;
+			if (name == "uchar" || name == "uint8") return Type::UInt8;
+			if (name == "short" || name == "int16") return Type::Int16;
+			if (name == "ushort" || name == "uint16") return Type::UInt16;
+			if (name == "int" || name == "int32") return Type::Int32;
+			if (name == "uint" || name == "uint32") return Type::UInt32;
+			if (name == "float" || name == "float32") return Type::Float32;
+			if (name == "double" || name == "float64") return Type::Float64;
+			return Type::Invalid;
+		};
+	auto typeSize = [](Type type) -> size_t
+		{
+			switch (type)
+			{
+			case Type::Int8: case Type::UInt8: return 1;
+			case Type::Int16: case Type::UInt16: return 2;
+			case Type::Int32: case Type::UInt32: case Type::Float32: return 4;
+			case Type::Float64: return 8;
+			default: return 0;
+			}
+		};
+
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		std::cerr << "Couldn't open the mesh with path : " << path << '\n';
+		return false;
+	}
+
+	const char* p = file.begin();
+	const char* end = file.end();
+	if (end - p < 4 || memcmp(p, "ply", 3) != 0)
+	{
+		std::cerr << "Not a PLY file : " << path << '\n';
+		return false;
+	}
+
+	bool big_endian = false, header_done = false;
+	std::vector<Element> elements;
+	static const char* vertex_names[] = { "x", "y", "z", "nx", "ny", "nz", "u", "v", "s", "t", "texture_u", "texture_v" };
+	for (SkipLine(p, end); p < end && !header_done; SkipLine(p, end))
+	{
+		SkipSpaces(p, end);
+		const char* token_end = p;
+		SkipToken(token_end, end);
+		std::string_view keyword(p, size_t(token_end - p));
+		p = token_end;
+		SkipSpaces(p, end);
+
+		if (keyword == "format")
+		{
+			if (StartsWith(p, end, "binary_big_endian"))
+				big_endian = true;
+			else if (!StartsWith(p, end, "binary_little_endian"))
+			{
+				std::cerr << "Only binary PLY files are supported : " << path << '\n';
+				return false;
+			}
+		}
+		else if (keyword == "element")
+		{
+			Element element;
+			element.vertex_ = StartsWith(p, end, "vertex");
+			element.face_ = StartsWith(p, end, "face");
+			SkipToken(p, end);
+			long long count = 0;
+			SkipSpaces(p, end);
+			if (!ParseInt(p, end, count) || count < 0)
+			{
+				std::cerr << "Bad element count in the mesh with path : " << path << '\n';
+				return false;
+			}
+			element.count_ = size_t(count);
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty())
+		{
+			Property property;
+			bool list = StartsWith(p, end, "list");
+			if (list)
+			{
+				SkipToken(p, end), SkipSpaces(p, end);
+				property.count_type_ = parseType(p, end);
+				SkipToken(p, end), SkipSpaces(p, end);
+			}
+			property.type_ = parseType(p, end);
+			SkipToken(p, end), SkipSpaces(p, end);
+			const char* name_end = p;
+			SkipToken(name_end, end);
+			std::string_view name(p, size_t(name_end - p));
+
+			Element& element = elements.back();
+			if (element.vertex_ && property.count_type_ == Type::Invalid)
+				for (int i = 0; i < 12; i++)
+					if (name == vertex_names[i])
+						property.target_ = (i < 8) ? i : (i < 10) ? i - 2 : i - 4; // s t and texture_u texture_v are other names of u v
+			if (element.face_ && property.count_type_ != Type::Invalid && (name == "vertex_indices" || name == "vertex_index"))
+				property.target_ = 0;
+			if (property.type_ == Type::Invalid || (list && property.count_type_ == Type::Invalid))
+			{
+				std::cerr << "Unknown property type in the mesh with path : " << path << '\n';
+				return false;
+			}
+			element.properties_.push_back(property);
+		}
+		else if (keyword == "end_header")
+			header_done = true;
+	}
+	if (!header_done)
+	{
+		std::cerr << "Missing end_header in the mesh with path : " << path << '\n';
+		return false;
+	}
+
+	const uint16_t byte_order_probe = 1;
+	bool swap = big_endian == (*reinterpret_cast<const uint8_t*>(&byte_order_probe) == 1);
+	auto read = [&](Type type, double& value) -> bool
+		{
+			size_t size = typeSize(type);
+			if (size_t(end - p) < size)
+				return false;
+			uint8_t bytes[8];
+			memcpy(bytes, p, size);
+			if (swap)
+				std::reverse(bytes, bytes + size);
+			p += size;
+			switch (type)
+			{
+			case Type::Int8: { int8_t v; memcpy(&v, bytes, 1); value = v; break; }
+			case Type::UInt8: { uint8_t v; memcpy(&v, bytes, 1); value = v; break; }
+			case Type::Int16: { int16_t v; memcpy(&v, bytes, 2); value = v; break; }
+			case Type::UInt16: { uint16_t v; memcpy(&v, bytes, 2); value = v; break; }
+			case Type::Int32: { int32_t v; memcpy(&v, bytes, 4); value = v; break; }
+			case Type::UInt32: { uint32_t v; memcpy(&v, bytes, 4); value = v; break; }
+			case Type::Float32: { float v; memcpy(&v, bytes, 4); value = v; break; }
+			case Type::Float64: { double v; memcpy(&v, bytes, 8); value = v; break; }
+			default: return false;
+			}
+			return true;
+		};
+
+	mesh = MeshData();
+	bool has_normals = false, has_uvs = false;
+	for (const Element& element : elements)
+		if (element.vertex_)
+			for (const Property& property : element.properties_)
+				has_normals |= property.target_ >= 3 && property.target_ < 6, has_uvs |= property.target_ >= 6;
+
+	for (const Element& element : elements)
+	{
+		if (element.vertex_)
+		{
+			mesh.positions_.reserve(element.count_);
+			if (has_normals)
+				mesh.normals_.reserve(element.count_);
+			if (has_uvs)
+				mesh.uvs_.reserve(2 * element.count_);
+		}
+		if (element.face_)
+			mesh.position_indices_.reserve(3 * element.count_);
+
+		for (size_t i = 0; i < element.count_; i++)
+		{
+			double vertex[8] = {};
+			bool complete = true;
+			for (const Property& property : element.properties_)
+			{
+				double value;
+				if (property.count_type_ == Type::Invalid)
+				{
+					complete = read(property.type_, value);
+					if (element.vertex_ && property.target_ >= 0)
+						vertex[property.target_] = value;
+				}
+				else
+				{
+					double count = 0;
+					complete = read(property.count_type_, count);
+					int32_t first = 0, previous = 0;
+					for (int corner = 0; corner < int(count) && complete; corner++)
+					{
+						complete = read(property.type_, value);
+						int32_t index = int32_t(value);
+						if (property.target_ != 0)
+							continue;
+						if (corner == 0)
+							first = index;
+						else if (corner >= 2)
+						{
+							mesh.position_indices_.push_back(first);
+							mesh.position_indices_.push_back(previous);
+							mesh.position_indices_.push_back(index);
+						}
+						previous = index;
+					}
+				}
+				if (!complete)
+				{
+					std::cerr << "The mesh with path : " << path << " is truncated\n";
+					return false;
+				}
+			}
+
+			if (element.vertex_)
+			{
+				mesh.positions_.push_back(vec3(vertex[0], vertex[1], vertex[2]));
+				if (has_normals)
+					mesh.normals_.push_back(vec3(vertex[3], vertex[4], vertex[5]));
+				if (has_uvs)
+					mesh.uvs_.push_back(vertex[6]), mesh.uvs_.push_back(vertex[7]);
+			}
+		}
+	}
+
+	for (int32_t index : mesh.position_indices_)
+		if (index < 0 || size_t(index) >= mesh.positions_.size())
+		{
+			std::cerr << "Vertex index out of range in the mesh with path : " << path << '\n';
+			return false;
+		}
+	// PLY corners share one index for every attribute
+	if (has_normals)
+		mesh.normal_indices_ = mesh.position_indices_;
+	if (has_uvs)
+		mesh.uv_indices_ = mesh.position_indices_;
+	return true;
+}
+
+// picks the loader from the extension, returns nullptr when the file couldn't be loaded
+inline std::shared_ptr<TriangleMesh> LoadMesh(const std::string& path, std::shared_ptr<Material> material, const BVHBuildOptions& options = BVHBuildOptions())
+{
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	for (char& c : extension)
+		c = char(tolower((unsigned char)c));
+
+	MeshData data;
+	bool loaded = false;
+	if (extension == "obj")
+		loaded = LoadOBJ(path.c_str(), data);
+	else if (extension == "ply")
+		loaded = LoadPLY(path.c_str(), data);
+	else
+		std::cerr << "Unknown mesh format : " << path << '\n';
+
+	if (!loaded)
+		return nullptr;
+	return std::make_shared<TriangleMesh>(std::move(data), material, options);
+}
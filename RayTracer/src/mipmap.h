@@ -0,0 +1,120 @@
+#pragma once
+
+#include "texel_storage.h"
+
+// an image and its halvings down to a single texel, in linear color; a lookup filters bilinearly inside
+// a level and blends the two levels around the size of its footprint, so distant and grazing surfaces
+// read a few texels of a small level instead of skipping over the full image
+class MipMap
+{
+
+	using Level = TexelStorage; // its first row is v = 0
+
+	std::vector<Level> levels_;
+
+	static Color getTexel(const Level& level, int x, int y)
+	{
+		x = (x < 0) ? 0 : (x >= level.width()) ? level.width() - 1 : x;
+		y = (y < 0) ? 0 : (y >= level.height()) ? level.height() - 1 : y;
+		return level.get(x, y);
+	}
+
+	// u = 0 and u = 1 are the centers of the first and the last column, as in the nearest lookup this replaces
+	Color getBilinear(const Level& level, double u, double v) const
+	{
+		u = IntervalT<double>(0, 1).clamp(u), v = IntervalT<double>(0, 1).clamp(v);
+		double x = u * (level.width() - 1), y = v * (level.height() - 1);
+		int x0 = int(x), y0 = int(y);
+		double tx = x - x0, ty = y - y0;
+
+		Color bottom = Lerp(getTexel(level, x0, y0), getTexel(level, x0 + 1, y0), tx);
+		Color top = Lerp(getTexel(level, x0, y0 + 1), getTexel(level, x0 + 1, y0 + 1), tx);
+		return Lerp(bottom, top, ty);
+	}
+
+	void addHalvedLevel()
+	{
+		levels_.push_back(getHalved(levels_.back()));
+	}
+
+public:
+
+	MipMap() = default;
+
+	// the next level of source in the same format and layout: every texel averages the 2x2 texels below it,
+	// sizes round up so the last row and column of an odd size still reach the next level, their 2x2 block
+	// reads them twice through the clamp in getTexel
+	static Level getHalved(const Level& source)
+	{
+		Level level((source.width() + 1) / 2, (source.height() + 1) / 2, source.getFormat(), source.getLayout());
+		for (int y = 0; y < level.height(); y++)
+			for (int x = 0; x < level.width(); x++)
+			{
+				Color sum = getTexel(source, 2 * x, 2 * y) + getTexel(source, 2 * x + 1, 2 * y)
+					+ getTexel(source, 2 * x, 2 * y + 1) + getTexel(source, 2 * x + 1, 2 * y + 1);
+				level.set(x, y, 0.25 * sum);
+			}
+		return level;
+	}
+
+	// the fractional level whose texels are footprint wide, for a base level of width x height texels
+	static double getLevel(double footprint, int width, int height)
+	{
+		return (footprint > 0) ? std::log2(footprint * std::sqrt(double(width) * height)) : 0;
+	}
+
+	// image holds gamma encoded colors with its first row at v = 0, format and layout are how every level stores them
+	explicit MipMap(const TGAImage& image, TexelFormat format = TexelFormat::Float32, TexelLayout layout = TexelLayout::RowMajor)
+	{
+		if (!image.width() || !image.height())
+			return;
+
+		Level base(image.width(), image.height(), format, layout);
+		for (int y = 0; y < base.height(); y++)
+			for (int x = 0; x < base.width(); x++)
+				base.set(x, y, gammaToLinear(toColor(image.get(x, y))));
+		levels_.push_back(std::move(base));
+
+		while (levels_.back().width() > 1 || levels_.back().height() > 1)
+			addHalvedLevel();
+	}
+
+	bool empty() const
+	{
+		return levels_.empty();
+	}
+
+	int getLevelCount() const
+	{
+		return int(levels_.size());
+	}
+
+	size_t getByteSize() const
+	{
+		size_t size = 0;
+		for (const Level& level : levels_)
+			size += level.getByteSize();
+		return size;
+	}
+
+	Color getValue(double u, double v) const
+	{
+		return getBilinear(levels_[0], u, v);
+	}
+
+	// footprint is the width of the area to average in uv units, each level doubles the size of a texel
+	Color getValue(double u, double v, double footprint) const
+	{
+		const Level& base = levels_[0];
+		double level = getLevel(footprint, base.width(), base.height());
+		if (level <= 0)
+			return getBilinear(base, u, v);
+
+		int last = getLevelCount() - 1;
+		if (level >= last)
+			return getBilinear(levels_[last], u, v);
+
+		int lower = int(level);
+		return Lerp(getBilinear(levels_[lower], u, v), getBilinear(levels_[lower + 1], u, v), level - lower);
+	}
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include <cstdint>
+
+// a node with its box at both ends of the shutter, a ray tests the box interpolated at its own time
+struct alignas(64) MotionBVHNode
+{
+	float bounds_[2][2][3]; // [time 0 / time 1][min / max][axis]
+	int32_t offset_; // interior nodes: index of the second child (the first one directly follows), leaves: first primitive
+	uint16_t primitive_count_; // 0 for interior nodes
+	uint8_t axis_;
+	uint8_t padding_;
+
+	// rounding outwards keeps both float boxes, and so every box interpolated between them, conservative
+	void setBounds(int time, const AABB& box)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lower = float(box.data_[axis].min_), upper = float(box.data_[axis].max_);
+			bounds_[time][0][axis] = (lower > box.data_[axis].min_) ? std::nextafter(lower, -std::numeric_limits<float>::infinity()) : lower;
+			bounds_[time][1][axis] = (upper < box.data_[axis].max_) ? std::nextafter(upper, std::numeric_limits<float>::infinity()) : upper;
+		}
+	}
+
+	bool hit(const Ray& r, double t_min, double t_max) const
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int near_side = r.sign_[axis], far_side = 1 - r.sign_[axis];
+			double near_plane = bounds_[0][near_side][axis] + r.time_ * (double(bounds_[1][near_side][axis]) - bounds_[0][near_side][axis]);
+			double far_plane = bounds_[0][far_side][axis] + r.time_ * (double(bounds_[1][far_side][axis]) - bounds_[0][far_side][axis]);
+			double t_enter = (near_plane - r.orig_.data[axis]) * r.inverse_dir_.data[axis];
+			double t_leave = (far_plane - r.orig_.data[axis]) * r.inverse_dir_.data[axis];
+			t_min = (t_enter > t_min) ? t_enter : t_min;
+			t_max = (t_leave < t_max) ? t_leave : t_max;
+		}
+		return t_min <= t_max;
+	}
+};
+
+static_assert(sizeof(MotionBVHNode) == 64, "MotionBVHNode should fill one cache line");
+
+// a LinearBVH for moving objects: the swept box of a fast object bloats every ancestor in a static BVH,
+// here each node only covers where its objects are at the ray's time
+class MotionBVH : public Hittable
+{
+
+	static const int stack_size_ = 64;
+
+	std::vector<MotionBVHNode> nodes_;
+	std::vector<std::shared_ptr<Hittable>> primitives_; // in leaf order, owns the objects
+	std::vector<const Hittable*> primitive_pointers_; // in leaf order, what traversal reads
+	AABB start_box_, end_box_;
+	BVHStatistics statistics_;
+
+	// the builder groups the objects by where they are in the middle of the shutter
+	static std::vector<AABB> middleBounds(const std::vector<AABB>& start_bounds, const std::vector<AABB>& end_bounds)
+	{
+		std::vector<AABB> bounds(start_bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++)
+		{
+			vec3 minimum, maximum;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				minimum.data[axis] = 0.5 * (start_bounds[i].data_[axis].min_ + end_bounds[i].data_[axis].min_);
+				maximum.data[axis] = 0.5 * (start_bounds[i].data_[axis].max_ + end_bounds[i].data_[axis].max_);
+			}
+			bounds[i] = AABB(minimum, maximum);
+		}
+		return bounds;
+	}
+
+public:
+
+	MotionBVH(const HittableList& list, BVHBuildOptions options = BVHBuildOptions())
+	{
+		size_t count = list.objects_.size();
+		std::vector<AABB> start_bounds(count), end_bounds(count);
+		for (size_t i = 0; i < count; i++)
+			list.objects_[i]->getMotionBounds(start_bounds[i], end_bounds[i]);
+
+		BVHBuilder builder(middleBounds(start_bounds, end_bounds), options);
+		if (builder.getStatistics().depth_ > stack_size_)
+		{
+			options.method_ = BVHBuildOptions::Method::Median;
+			builder = BVHBuilder(middleBounds(start_bounds, end_bounds), options);
+		}
+
+		const std::vector<BVHBuildNode>& build_nodes = builder.getNodes();
+		const std::vector<int>& order = builder.getPrimitiveOrder();
+		nodes_.resize(build_nodes.size());
+		std::vector<AABB> node_start(build_nodes.size(), AABB::Empty), node_end(build_nodes.size(), AABB::Empty);
+
+		// children come after their parent in depth first order, so walking backwards visits them first
+		for (size_t i = build_nodes.size(); i-- > 0;)
+		{
+			const BVHBuildNode& build_node = build_nodes[i];
+			if (build_node.isLeaf())
+			{
+				for (int k = 0; k < build_node.primitive_count_; k++)
+				{
+					int primitive = order[build_node.first_primitive_ + k];
+					node_start[i] = AABB(node_start[i], start_bounds[primitive]);
+					node_end[i] = AABB(node_end[i], end_bounds[primitive]);
+				}
+			}
+			else
+			{
+				node_start[i] = AABB(node_start[build_node.left_], node_start[build_node.right_]);
+				node_end[i] = AABB(node_end[build_node.left_], node_end[build_node.right_]);
+			}
+
+			MotionBVHNode& node = nodes_[i];
+			node.setBounds(0, node_start[i]);
+			node.setBounds(1, node_end[i]);
+			node.offset_ = build_node.isLeaf() ? build_node.first_primitive_ : build_node.right_;
+			node.primitive_count_ = build_node.isLeaf() ? uint16_t(build_node.primitive_count_) : 0;
+			node.axis_ = uint8_t(build_node.axis_);
+			node.padding_ = 0;
+		}
+
+		primitives_.resize(order.size());
+		primitive_pointers_.resize(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			primitives_[i] = list.objects_[order[i]];
+			primitive_pointers_[i] = primitives_[i].get();
+		}
+		if (!nodes_.empty())
+			start_box_ = node_start[0], end_box_ = node_end[0];
+		statistics_ = builder.getStatistics();
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+		bool hit_anything = false;
+
+		while (true)
+		{
+			const MotionBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ > 0)
+				{
+					for (int i = 0; i < node.primitive_count_; i++)
+						if (primitive_pointers_[node.offset_ + i]->hit(r, ray_t, rec))
+						{
+							hit_anything = true;
+							ray_t.max_ = rec.t_;
+						}
+				}
+				else
+				{
+					if (r.sign_[node.axis_])
+					{
+						stack[stack_top++] = node_index + 1;
+						node_index = node.offset_;
+					}
+					else
+					{
+						stack[stack_top++] = node.offset_;
+						node_index = node_index + 1;
+					}
+					continue;
+				}
+			}
+
+			if (stack_top == 0)
+				break;
+			node_index = stack[--stack_top];
+		}
+
+		return hit_anything;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+
+		while (true)
+		{
+			const MotionBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ == 0)
+				{
+					stack[stack_top++] = node.offset_;
+					node_index = node_index + 1;
+					continue;
+				}
+				for (int i = 0; i < node.primitive_count_; i++)
+					if (primitive_pointers_[node.offset_ + i]->occluded(r, ray_t))
+						return true;
+			}
+
+			if (stack_top == 0)
+				return false;
+			node_index = stack[--stack_top];
+		}
+	}
+
+	AABB getBoundingBox() const override
+	{
+		return AABB(start_box_, end_box_);
+	}
+
+	void getMotionBounds(AABB& start, AABB& end) const override
+	{
+		start = start_box_;
+		end = end_box_;
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		for (const Hittable* primitive : primitive_pointers_)
+			primitive->collectLights(lights);
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+
+	// every node box has to hold its children, and every leaf box its primitives, at both ends of the shutter
+	bool boundsNested() const
+	{
+		for (size_t i = 0; i < nodes_.size(); i++)
+		{
+			const MotionBVHNode& node = nodes_[i];
+			for (int time = 0; time < 2; time++)
+				for (int axis = 0; axis < 3; axis++)
+				{
+					auto holds = [&](double lower, double upper) { return node.bounds_[time][0][axis] <= lower && upper <= node.bounds_[time][1][axis]; };
+					if (node.primitive_count_ == 0)
+					{
+						const MotionBVHNode& left = nodes_[i + 1];
+						const MotionBVHNode& right = nodes_[node.offset_];
+						if (!holds(left.bounds_[time][0][axis], left.bounds_[time][1][axis]) || !holds(right.bounds_[time][0][axis], right.bounds_[time][1][axis]))
+							return false;
+					}
+					for (int k = 0; k < node.primitive_count_; k++)
+					{
+						AABB start, end;
+						primitive_pointers_[node.offset_ + k]->getMotionBounds(start, end);
+						const AABB& box = (time == 0) ? start : end;
+						if (!holds(box.data_[axis].min_, box.data_[axis].max_))
+							return false;
+					}
+				}
+		}
+		return true;
+	}
+};
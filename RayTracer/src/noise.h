@@ -2,6 +2,7 @@
 
 #include "utility.h"
 #include "vec.h"
+#include "simd.h"
 
 class Noise
 {
@@ -12,15 +13,39 @@ public:
 	virtual double getValue(const vec3& point) const = 0;
 	virtual double getTurbuelence(const vec3& point, int depth) const = 0;
 
+	// the same for a packet of points, results[i] belongs to points[i]
+	virtual void getValues(const vec3* points, int count, double* results) const
+	{
+		for (int i = 0; i < count; i++)
+			results[i] = getValue(points[i]);
+	}
+
+	virtual void getTurbulences(const vec3* points, int count, int depth, double* results) const
+	{
+		for (int i = 0; i < count; i++)
+			results[i] = getTurbuelence(points[i], depth);
+	}
 };
 
-class ValueNoise : public Noise
+// noise defined on an integer lattice hashed through a permutation table; with AVX2 the subclasses evaluate
+// 4 points at once, the octaves of one point for turbulence or 4 points of a packet, with the operations of
+// getValue in the same order, so the results match it bit for bit (in float builds, within float rounding)
+class LatticeNoise : public Noise
 {
 
+protected:
+
 	int point_count_ = 256;
-	std::vector<double> random_values_;
 	std::vector<int> permutation_table_;
+	bool use_avx2_;
 
+	LatticeNoise(int grid_size) : point_count_(grid_size), use_avx2_(CpuSupportsAVX2())
+	{
+		if ((point_count_ & (point_count_ - 1)) != 0)
+		{
+			std::cerr << "point_count_ must be a power of 2\n";
+		}
+	}
 
 	void generatePermutationTable()
 	{
@@ -43,15 +68,223 @@ class ValueNoise : public Noise
 		}
 	}
 
+	int hash(int x, int y, int z) const
+	{
+		return permutation_table_[permutation_table_[permutation_table_[x] + y] + z];
+	}
+
+#if defined(RT_SIMD_X86)
+	// getValue of the 4 points (x[i], y[i], z[i]), one per lane
+	virtual void getValues4(const double* x, const double* y, const double* z, double* results) const = 0;
+
+	// the hashes of the 8 corners around the 4 points (x[i], y[i], z[i]), corner (i, j, k) of lane l in hashes[i + 2 * j + 4 * k][l],
+	// and the positions inside the cells; the lookups stay scalar (gathers are slower than plain loads on many cpus)
+	// and the corners share the first two levels of the hash
+	RT_TARGET_AVX2_EXACT void getCells4(const double* x, const double* y, const double* z, int hashes[8][4], __m256d& tx, __m256d& ty, __m256d& tz) const
+	{
+		alignas(16) int lower[3][4], upper[3][4];
+		getCells(set4(x), lower[0], upper[0], tx);
+		getCells(set4(y), lower[1], upper[1], ty);
+		getCells(set4(z), lower[2], upper[2], tz);
+
+		const int* table = permutation_table_.data();
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int x_hash[2] = { table[lower[0][lane]], table[upper[0][lane]] };
+			int y_cell[2] = { lower[1][lane], upper[1][lane] };
+			int z_cell[2] = { lower[2][lane], upper[2][lane] };
+			for (int j = 0; j < 2; j++)
+			{
+				for (int i = 0; i < 2; i++)
+				{
+					int xy_hash = table[x_hash[i] + y_cell[j]];
+					hashes[i + 2 * j][lane] = table[xy_hash + z_cell[0]];
+					hashes[i + 2 * j + 4][lane] = table[xy_hash + z_cell[1]];
+				}
+			}
+		}
+	}
+
+	// the corners below and above on one axis, masked into the table, and the position inside the cell
+	RT_TARGET_AVX2_EXACT void getCells(__m256d coordinate, int* lower, int* upper, __m256d& fraction) const
+	{
+		__m128i mask = _mm_set1_epi32(point_count_ - 1);
+		__m256d floor = _mm256_floor_pd(coordinate);
+		fraction = _mm256_sub_pd(coordinate, floor);
+		__m128i cell = _mm_and_si128(_mm256_cvttpd_epi32(floor), mask);
+		_mm_store_si128(reinterpret_cast<__m128i*>(lower), cell);
+		_mm_store_si128(reinterpret_cast<__m128i*>(upper), _mm_and_si128(_mm_add_epi32(cell, _mm_set1_epi32(1)), mask));
+	}
+
+	// the callers write the 4 lanes one by one, a vector load right after that would wait for the stores to drain
+	RT_TARGET_AVX2_EXACT static __m256d set4(const double* lanes)
+	{
+		return _mm256_set_pd(lanes[3], lanes[2], lanes[1], lanes[0]);
+	}
+
+	// (1 - t) * a + t * b, as Lerp
+	RT_TARGET_AVX2_EXACT static __m256d lerp4(__m256d a, __m256d b, __m256d t)
+	{
+		return _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1), t), a), _mm256_mul_pd(t, b));
+	}
+
+	// 4 octaves of one point per kernel call, the last call repeats its last octave in the unused lanes
+	RT_TARGET_AVX2_EXACT double getTurbulenceAVX2(const vec3& point, int depth) const
+	{
+		double accumulation = 0.0f;
+		double weight = 1.0f;
+		double frequency = 1.0f;
+		for (int first = 0; first < depth; first += 4)
+		{
+			int count = (depth - first < 4) ? depth - first : 4;
+			double x[4], y[4], z[4], values[4];
+			for (int i = 0; i < 4; i++)
+			{
+				vec3 scaled = frequency * point;
+				x[i] = scaled.x, y[i] = scaled.y, z[i] = scaled.z;
+				if (i + 1 < count)
+					frequency *= 2.0;
+			}
+			getValues4(x, y, z, values);
+			for (int i = 0; i < count; i++)
+			{
+				accumulation += weight * values[i];
+				weight *= 0.5;
+			}
+			frequency *= 2.0;
+		}
+		return fabs(accumulation);
+	}
+
+	// 4 points per kernel call, a partial packet repeats its first point in the unused lanes
+	RT_TARGET_AVX2_EXACT void getValuesAVX2(const vec3* points, int count, double* results) const
+	{
+		for (int first = 0; first < count; first += 4)
+		{
+			int lanes = (count - first < 4) ? count - first : 4;
+			double x[4], y[4], z[4], values[4];
+			for (int i = 0; i < 4; i++)
+			{
+				const vec3& point = points[first + ((i < lanes) ? i : 0)];
+				x[i] = point.x, y[i] = point.y, z[i] = point.z;
+			}
+			getValues4(x, y, z, values);
+			for (int i = 0; i < lanes; i++)
+				results[first + i] = values[i];
+		}
+	}
+
+	// 4 points per kernel call and octave, each point sums its octaves in the order getTurbuelence does
+	RT_TARGET_AVX2_EXACT void getTurbulencesAVX2(const vec3* points, int count, int depth, double* results) const
+	{
+		for (int first = 0; first < count; first += 4)
+		{
+			int lanes = (count - first < 4) ? count - first : 4;
+			double x[4], y[4], z[4], values[4];
+			double accumulation[4] = { 0, 0, 0, 0 };
+			double weight = 1.0f;
+			double frequency = 1.0f;
+			for (int octave = 0; octave < depth; octave++)
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					vec3 scaled = frequency * points[first + ((i < lanes) ? i : 0)];
+					x[i] = scaled.x, y[i] = scaled.y, z[i] = scaled.z;
+				}
+				getValues4(x, y, z, values);
+				for (int i = 0; i < 4; i++)
+					accumulation[i] += weight * values[i];
+				weight *= 0.5;
+				frequency *= 2.0;
+			}
+			for (int i = 0; i < lanes; i++)
+				results[first + i] = fabs(accumulation[i]);
+		}
+	}
+#endif
+
 public:
 
-	ValueNoise(int grid_size) : point_count_(grid_size)
+	double getTurbuelence(const vec3& point, int depth) const override
 	{
-		if ((point_count_ & (point_count_ - 1)) != 0)
+#if defined(RT_SIMD_X86)
+		if (use_avx2_)
+			return getTurbulenceAVX2(point, depth);
+#endif
+		double accumulation = 0.0f;
+		double weight = 1.0f;
+		double frequency = 1.0f;
+		for (int i = 0; i < depth; i++)
 		{
-			std::cerr << "point_count_ must be a power of 2\n";
+			accumulation += weight * getValue(frequency * point);
+			weight *= 0.5;
+			frequency *= 2.0;
 		}
 
+		return fabs(accumulation);
+	}
+
+	void getValues(const vec3* points, int count, double* results) const override
+	{
+#if defined(RT_SIMD_X86)
+		if (use_avx2_)
+			return getValuesAVX2(points, count, results);
+#endif
+		Noise::getValues(points, count, results);
+	}
+
+	void getTurbulences(const vec3* points, int count, int depth, double* results) const override
+	{
+#if defined(RT_SIMD_X86)
+		if (use_avx2_)
+			return getTurbulencesAVX2(points, count, depth, results);
+#endif
+		Noise::getTurbulences(points, count, depth, results);
+	}
+};
+
+class ValueNoise : public LatticeNoise
+{
+
+	std::vector<double> random_values_;
+
+#if defined(RT_SIMD_X86)
+	// Smoothstep(0, 1, t) for t in [0, 1)
+	RT_TARGET_AVX2_EXACT static __m256d smoothstep4(__m256d t)
+	{
+		return _mm256_mul_pd(_mm256_mul_pd(t, t), _mm256_sub_pd(_mm256_set1_pd(3), _mm256_mul_pd(_mm256_set1_pd(2), t)));
+	}
+
+	RT_TARGET_AVX2_EXACT void getValues4(const double* x, const double* y, const double* z, double* results) const override
+	{
+		alignas(16) int hashes[8][4];
+		__m256d tx, ty, tz;
+		getCells4(x, y, z, hashes, tx, ty, tz);
+		__m256d u = smoothstep4(tx), v = smoothstep4(ty), w = smoothstep4(tz);
+
+		__m256d values[8];
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const int* hash = hashes[corner];
+			values[corner] = _mm256_set_pd(random_values_[hash[3]], random_values_[hash[2]], random_values_[hash[1]], random_values_[hash[0]]);
+		}
+
+		__m256d value_00 = lerp4(values[0], values[1], u);
+		__m256d value_10 = lerp4(values[2], values[3], u);
+		__m256d value__0 = lerp4(value_00, value_10, v);
+
+		__m256d value_01 = lerp4(values[4], values[5], u);
+		__m256d value_11 = lerp4(values[6], values[7], u);
+		__m256d value__1 = lerp4(value_01, value_11, v);
+
+		_mm256_storeu_pd(results, lerp4(value__0, value__1, w));
+	}
+#endif
+
+public:
+
+	ValueNoise(int grid_size) : LatticeNoise(grid_size)
+	{
 		random_values_.resize(point_count_);
 		for (int i = 0; i < point_count_; i++)
 		{
@@ -61,11 +294,6 @@ public:
 		generatePermutationTable();
 	}
 
-	int hash(int x, int y, int z) const
-	{
-		return permutation_table_[permutation_table_[permutation_table_[x] + y] + z];
-	}
-
 	double getValue(const vec3& point) const override
 	{
 		int x_min = std::floor(point.x);
@@ -110,61 +338,61 @@ public:
 
 		return Lerp(value__0, value__1, w);
 	}
-
-	double getTurbuelence(const vec3& point, int depth) const override
-	{
-		double accumulation = 0.0f;
-		double weight = 1.0f;
-		double frequency = 1.0f;
-		for (int i = 0; i < depth; i++)
-		{
-			accumulation += weight * getValue(frequency * point);
-			weight *= 0.5;
-			frequency *= 2.0;
-		}
-
-		return fabs(accumulation);
-	}
 };
 
-class PerlinNoise : public Noise
+class PerlinNoise : public LatticeNoise
 {
 
-	int point_count_ = 256;
 	std::vector<vec3> random_gradients_;
-	std::vector<int> permutation_table_;
 
+#if defined(RT_SIMD_X86)
+	// Smootherstep(t)
+	RT_TARGET_AVX2_EXACT static __m256d smootherstep4(__m256d t)
+	{
+		__m256d polynomial = _mm256_add_pd(_mm256_mul_pd(t, _mm256_sub_pd(_mm256_mul_pd(t, _mm256_set1_pd(6.0)), _mm256_set1_pd(15.0))), _mm256_set1_pd(10.0));
+		return _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(t, t), t), polynomial);
+	}
 
-	void generatePermutationTable()
+	RT_TARGET_AVX2_EXACT void getValues4(const double* x, const double* y, const double* z, double* results) const override
 	{
-		permutation_table_.resize(2 * point_count_);
-		for (int i = 0; i < point_count_; i++)
+		alignas(16) int hashes[8][4];
+		__m256d tx, ty, tz;
+		getCells4(x, y, z, hashes, tx, ty, tz);
+		__m256d u = smootherstep4(tx), v = smootherstep4(ty), w = smootherstep4(tz);
+
+		// the direction from corner (i, j, k) is (tx - i, ty - j, tz - k)
+		__m256d one = _mm256_set1_pd(1);
+		__m256d dx[2] = { tx, _mm256_sub_pd(tx, one) }, dy[2] = { ty, _mm256_sub_pd(ty, one) }, dz[2] = { tz, _mm256_sub_pd(tz, one) };
+		__m256d dots[8];
+		for (int corner = 0; corner < 8; corner++)
 		{
-			permutation_table_[i] = i;
+			const int* hash = hashes[corner];
+			const vec3& g0 = random_gradients_[hash[0]];
+			const vec3& g1 = random_gradients_[hash[1]];
+			const vec3& g2 = random_gradients_[hash[2]];
+			const vec3& g3 = random_gradients_[hash[3]];
+			__m256d x_term = _mm256_mul_pd(_mm256_set_pd(g3.x, g2.x, g1.x, g0.x), dx[corner & 1]);
+			__m256d y_term = _mm256_mul_pd(_mm256_set_pd(g3.y, g2.y, g1.y, g0.y), dy[(corner >> 1) & 1]);
+			__m256d z_term = _mm256_mul_pd(_mm256_set_pd(g3.z, g2.z, g1.z, g0.z), dz[corner >> 2]);
+			dots[corner] = _mm256_add_pd(_mm256_add_pd(x_term, y_term), z_term);
 		}
 
-		for (int i = 0; i < point_count_; i++)
-		{
-			int random = RandomInteger(0, point_count_ - 1);
+		__m256d value_00 = lerp4(dots[0], dots[1], u);
+		__m256d value_10 = lerp4(dots[2], dots[3], u);
+		__m256d value__0 = lerp4(value_00, value_10, v);
 
-			std::swap(permutation_table_[i], permutation_table_[random]);
-		}
+		__m256d value_01 = lerp4(dots[4], dots[5], u);
+		__m256d value_11 = lerp4(dots[6], dots[7], u);
+		__m256d value__1 = lerp4(value_01, value_11, v);
 
-		for (int i = 0; i < point_count_; i++)
-		{
-			permutation_table_[point_count_ + i] = permutation_table_[i];
-		}
+		_mm256_storeu_pd(results, lerp4(value__0, value__1, w));
 	}
+#endif
 
 public:
 
-	PerlinNoise(int grid_size) : point_count_(grid_size)
+	PerlinNoise(int grid_size) : LatticeNoise(grid_size)
 	{
-		if ((point_count_ & (point_count_ - 1)) != 0)
-		{
-			std::cerr << "point_count_ must be a power of 2\n";
-		}
-
 		random_gradients_.resize(point_count_);
 		for (int i = 0; i < point_count_; i++)
 		{
@@ -174,11 +402,6 @@ public:
 		generatePermutationTable();
 	}
 
-	int hash(int x, int y, int z) const
-	{
-		return permutation_table_[permutation_table_[permutation_table_[x] + y] + z];
-	}
-
 	double getValue(const vec3& point) const override
 	{
 		int x_min = std::floor(point.x);
@@ -235,19 +458,4 @@ public:
 
 		return Lerp(value__0, value__1, w);
 	}
-
-	double getTurbuelence(const vec3& point, int depth) const override
-	{
-		double accumulation = 0.0f;
-		double weight = 1.0f;
-		double frequency = 1.0f;
-		for (int i = 0; i < depth; i++)
-		{
-			accumulation += weight * getValue(frequency * point);
-			weight *= 0.5;
-			frequency *= 2.0;
-		}
-
-		return fabs(accumulation);
-	}
 };
\ No newline at end of file
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "noise.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+struct NoiseVolumeOptions
+{
+	enum class Filter { Trilinear, Tricubic };
+
+	int resolution_ = 256; // samples per axis of the box, rounded up to whole bricks
+	vec3 origin_ = vec3(-8, -8, -8); // lowest corner of the baked box
+	double extent_ = 16; // world size of the box along each axis, lookups outside it evaluate the noise
+	size_t memory_budget_ = size_t(256) << 20; // in bytes, the resolution is lowered until the grid fits
+	Filter filter_ = Filter::Trilinear;
+	bool lazy_ = false; // bake a brick when a lookup first needs it instead of all of them up front
+	int thread_count_ = 0; // threads of the up front bake, 0 uses every hardware thread
+};
+
+struct NoiseVolumeStatistics
+{
+	int resolution_ = 0;
+	int brick_count_ = 0;
+	int baked_bricks_ = 0;
+	size_t memory_bytes_ = 0; // samples of the baked bricks
+	double bake_seconds_ = 0; // summed over the threads that baked
+
+	void print(std::ostream& out) const
+	{
+		out << "Noise volume: " << resolution_ << "^3 samples, baked " << baked_bricks_ << " of " << brick_count_ << " bricks in "
+			<< bake_seconds_ * 1000 << "ms, " << memory_bytes_ / double(1 << 20) << "MB\n";
+	}
+};
+
+// the turbulence of a noise sampled on a grid over a box, so shading interpolates a few samples instead of
+// evaluating every octave; the lattice noise only repeats every 256 units, far too long to bake as a tile, so
+// lookups whose filter reaches outside the box fall back to the noise itself. the grid is stored in bricks of
+// 8^3 neighboring samples that are baked as one packet, either all of them when the volume is made or each one
+// the first time a lookup reads from it
+class NoiseVolume
+{
+
+	static const int brick_size_ = 8;
+	static const int brick_samples_ = brick_size_ * brick_size_ * brick_size_;
+
+	enum BrickState : uint8_t { Empty, Baking, Ready };
+
+	std::shared_ptr<Noise> noise_;
+	int depth_;
+	NoiseVolumeOptions options_;
+	int resolution_;
+	int bricks_per_axis_;
+	int brick_count_;
+	double spacing_; // world distance between neighboring samples
+	std::unique_ptr<float[]> samples_; // brick after brick, uninitialized so the pages of bricks that are never baked stay untouched
+	std::unique_ptr<std::atomic<uint8_t>[]> brick_states_;
+	mutable std::atomic<int> baked_bricks_{ 0 };
+	mutable std::atomic<long long> bake_nanoseconds_{ 0 };
+
+	void bakeBrick(int brick) const
+	{
+		auto start_time = std::chrono::steady_clock::now();
+		int brick_x = brick % bricks_per_axis_;
+		int brick_y = (brick / bricks_per_axis_) % bricks_per_axis_;
+		int brick_z = brick / (bricks_per_axis_ * bricks_per_axis_);
+
+		std::vector<vec3> points(brick_samples_);
+		std::vector<double> values(brick_samples_);
+		for (int z = 0; z < brick_size_; z++)
+		{
+			for (int y = 0; y < brick_size_; y++)
+			{
+				for (int x = 0; x < brick_size_; x++)
+				{
+					points[(z * brick_size_ + y) * brick_size_ + x] = options_.origin_ + vec3(Real((brick_x * brick_size_ + x) * spacing_),
+						Real((brick_y * brick_size_ + y) * spacing_), Real((brick_z * brick_size_ + z) * spacing_));
+				}
+			}
+		}
+		noise_->getTurbulences(points.data(), brick_samples_, depth_, values.data());
+
+		float* destination = &samples_[size_t(brick) * brick_samples_];
+		for (int i = 0; i < brick_samples_; i++)
+			destination[i] = float(values[i]);
+
+		baked_bricks_++;
+		bake_nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	// the first thread to need a lazy brick bakes it, the others wait until it is done
+	void requireBrick(int brick) const
+	{
+		std::atomic<uint8_t>& state = brick_states_[brick];
+		if (state.load(std::memory_order_acquire) == Ready)
+			return;
+
+		uint8_t expected = Empty;
+		if (state.compare_exchange_strong(expected, Baking, std::memory_order_acquire))
+		{
+			bakeBrick(brick);
+			state.store(Ready, std::memory_order_release);
+			return;
+		}
+		while (state.load(std::memory_order_acquire) != Ready)
+			std::this_thread::yield();
+	}
+
+	void bakeAll()
+	{
+		int thread_count = (options_.thread_count_ > 0) ? options_.thread_count_ : int(std::thread::hardware_concurrency());
+		thread_count = (thread_count < 1) ? 1 : (thread_count > brick_count_) ? brick_count_ : thread_count;
+
+		std::atomic<int> next_brick{ 0 };
+		auto work = [this, &next_brick]()
+			{
+				for (int brick = next_brick++; brick < brick_count_; brick = next_brick++)
+				{
+					bakeBrick(brick);
+					brick_states_[brick].store(Ready, std::memory_order_release);
+				}
+			};
+
+		std::vector<std::thread> threads;
+		for (int i = 1; i < thread_count; i++)
+			threads.emplace_back(work);
+		work();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	// x, y and z are in [0, resolution_)
+	float getSample(int x, int y, int z) const
+	{
+		int brick = ((z / brick_size_) * bricks_per_axis_ + y / brick_size_) * bricks_per_axis_ + x / brick_size_;
+		if (options_.lazy_)
+			requireBrick(brick);
+		return samples_[size_t(brick) * brick_samples_ + ((z % brick_size_) * brick_size_ + y % brick_size_) * brick_size_ + x % brick_size_];
+	}
+
+	// whether the samples from low below to high above the grid cell at (x, y, z) all exist, taken in double so
+	// points far outside the box don't overflow an int
+	bool covers(double x, double y, double z, int low, int high) const
+	{
+		return x >= low && y >= low && z >= low && x + high < resolution_ && y + high < resolution_ && z + high < resolution_;
+	}
+
+	// Catmull-Rom weights of the samples at -1, 0, 1 and 2 for a position t in [0, 1)
+	static void getCubicWeights(double t, double* weights)
+	{
+		weights[0] = 0.5 * ((-t + 2) * t - 1) * t;
+		weights[1] = 0.5 * ((3 * t - 5) * t * t + 2);
+		weights[2] = 0.5 * ((-3 * t + 4) * t + 1) * t;
+		weights[3] = 0.5 * (t - 1) * t * t;
+	}
+
+public:
+
+	// samples noise->getTurbuelence(point, depth) at origin + (x, y, z) * extent / resolution for every grid index
+	NoiseVolume(std::shared_ptr<Noise> noise, int depth, const NoiseVolumeOptions& options = NoiseVolumeOptions())
+		: noise_(std::move(noise)), depth_(depth), options_(options)
+	{
+		resolution_ = (options_.resolution_ < brick_size_) ? brick_size_ : options_.resolution_;
+		resolution_ = (resolution_ + brick_size_ - 1) / brick_size_ * brick_size_;
+		while (resolution_ > brick_size_ && size_t(resolution_) * resolution_ * resolution_ * sizeof(float) > options_.memory_budget_)
+			resolution_ -= brick_size_;
+		if (resolution_ < options_.resolution_)
+		{
+			std::cerr << "NoiseVolume: " << options_.resolution_ << "^3 samples exceed the memory budget, using "
+				<< resolution_ << "^3\n";
+		}
+
+		bricks_per_axis_ = resolution_ / brick_size_;
+		brick_count_ = bricks_per_axis_ * bricks_per_axis_ * bricks_per_axis_;
+		spacing_ = options_.extent_ / resolution_;
+		samples_.reset(new float[size_t(brick_count_) * brick_samples_]);
+		brick_states_.reset(new std::atomic<uint8_t>[brick_count_]);
+		for (int i = 0; i < brick_count_; i++)
+			brick_states_[i].store(Empty, std::memory_order_relaxed);
+
+		if (!options_.lazy_)
+			bakeAll();
+	}
+
+	NoiseVolume(const NoiseVolume&) = delete;
+	NoiseVolume& operator=(const NoiseVolume&) = delete;
+
+	double getTurbulence(const vec3& point) const
+	{
+		double x = (point.x - options_.origin_.x) / spacing_, y = (point.y - options_.origin_.y) / spacing_, z = (point.z - options_.origin_.z) / spacing_;
+		double x_floor = std::floor(x), y_floor = std::floor(y), z_floor = std::floor(z);
+		double tx = x - x_floor, ty = y - y_floor, tz = z - z_floor;
+
+		// the filter reads 1 sample below and 2 above the cell for tricubic, the cell's corners for trilinear
+		bool tricubic = options_.filter_ == NoiseVolumeOptions::Filter::Tricubic;
+		int low = tricubic ? 1 : 0, high = tricubic ? 2 : 1;
+		if (!covers(x_floor, y_floor, z_floor, low, high))
+			return noise_->getTurbuelence(point, depth_);
+		int x_min = int(x_floor), y_min = int(y_floor), z_min = int(z_floor);
+
+		if (tricubic)
+		{
+			double wx[4], wy[4], wz[4];
+			getCubicWeights(tx, wx);
+			getCubicWeights(ty, wy);
+			getCubicWeights(tz, wz);
+
+			double value = 0;
+			for (int k = 0; k < 4; k++)
+			{
+				double plane = 0;
+				for (int j = 0; j < 4; j++)
+				{
+					double row = 0;
+					for (int i = 0; i < 4; i++)
+						row += wx[i] * getSample(x_min + i - 1, y_min + j - 1, z_min + k - 1);
+					plane += wy[j] * row;
+				}
+				value += wz[k] * plane;
+			}
+			return value;
+		}
+
+		double value_00 = Lerp<double>(getSample(x_min, y_min, z_min), getSample(x_min + 1, y_min, z_min), tx);
+		double value_10 = Lerp<double>(getSample(x_min, y_min + 1, z_min), getSample(x_min + 1, y_min + 1, z_min), tx);
+		double value_01 = Lerp<double>(getSample(x_min, y_min, z_min + 1), getSample(x_min + 1, y_min, z_min + 1), tx);
+		double value_11 = Lerp<double>(getSample(x_min, y_min + 1, z_min + 1), getSample(x_min + 1, y_min + 1, z_min + 1), tx);
+		return Lerp(Lerp(value_00, value_10, ty), Lerp(value_01, value_11, ty), tz);
+	}
+
+	int getDepth() const
+	{
+		return depth_;
+	}
+
+	NoiseVolumeStatistics getStatistics() const
+	{
+		NoiseVolumeStatistics statistics;
+		statistics.resolution_ = resolution_;
+		statistics.brick_count_ = brick_count_;
+		statistics.baked_bricks_ = baked_bricks_.load();
+		statistics.memory_bytes_ = size_t(statistics.baked_bricks_) * brick_samples_ * sizeof(float);
+		statistics.bake_seconds_ = bake_nanoseconds_.load() * 1e-9;
+		return statistics;
+	}
+};
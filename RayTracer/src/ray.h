@@ -1,21 +1,48 @@
 #pragma once
 #include "Vec.h"
 
-class Ray {
+template <typename T>
+class RayT {
 
 public:
-	double time_;
-	vec3 orig_, dir_;
+	T time_;
+	Vec3T<T> orig_, dir_;
+	// cached for the slab tests of every box the ray visits; a zero component gives an infinite inverse,
+	// and its sign bit (of the signed zero) still tells which plane of that axis is entered first
+	Vec3T<T> inverse_dir_;
+	int sign_[3];
 
-	Ray() {}
+	RayT() : time_(0), sign_{ 0, 0, 0 } {}
 
-	Ray(vec3 origin, vec3 direction) :orig_(origin), dir_(direction) {}
+	RayT(Vec3T<T> origin, Vec3T<T> direction) : RayT(origin, direction, 0) {}
 
-	Ray(vec3 origin, vec3 direction, double time) : orig_(origin), dir_(direction), time_(time) {}
+	RayT(Vec3T<T> origin, Vec3T<T> direction, T time) : orig_(origin), dir_(direction), time_(time)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			inverse_dir_.data[axis] = T(1) / dir_.data[axis];
+			sign_[axis] = std::signbit(dir_.data[axis]) ? 1 : 0;
+		}
+	}
 
-	vec3 At(double t) const{
+	Vec3T<T> At(T t) const{
 
-		vec3 temp = t * dir_;
+		Vec3T<T> temp = t * dir_;
 		return orig_ + temp;
 	}
-};
\ No newline at end of file
+};
+
+using Ray = RayT<Real>;
+
+// where a ray leaving a surface at origin starts; the fixed offset is plenty in double, in float the rounding
+// error of a hit point grows with its distance from the world origin, so there it follows the largest coordinate
+inline Real RayOffset(const Vec3& origin)
+{
+	Real magnitude = std::fmax(std::fabs(origin.x), std::fmax(std::fabs(origin.y), std::fabs(origin.z)));
+	Real relative = 64 * std::numeric_limits<Real>::epsilon() * magnitude;
+	return (relative > Real(0.001)) ? relative : Real(0.001);
+}
+
+// a slab test in float rounds t, widening the far end by a few ulps keeps it from missing boxes a ray only grazes;
+// double slab tests never needed it, so there the factor is 1
+const Real SlabSlack = (sizeof(Real) < sizeof(double)) ? 1 + 4 * std::numeric_limits<Real>::epsilon() : 1;
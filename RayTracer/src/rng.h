@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+// PCG32 (permuted congruential generator, O'Neill 2014): 16 bytes of state, no locks and no allocations
+class PCG32
+{
+
+	uint64_t state_;
+	uint64_t increment_; // selects one of 2^63 independent streams, must be odd
+
+public:
+
+	PCG32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t sequence = 0xda3e39cb94b95bdbULL)
+	{
+		setSeed(seed, sequence);
+	}
+
+	void setSeed(uint64_t seed, uint64_t sequence = 0)
+	{
+		state_ = 0;
+		increment_ = (sequence << 1) | 1;
+		nextUInt();
+		state_ += seed;
+		nextUInt();
+	}
+
+	uint32_t nextUInt()
+	{
+		uint64_t old_state = state_;
+		state_ = old_state * 6364136223846793005ULL + increment_;
+		uint32_t xor_shifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+		uint32_t rotation = uint32_t(old_state >> 59);
+		return (xor_shifted >> rotation) | (xor_shifted << ((~rotation + 1) & 31));
+	}
+
+	// uniform in [0, 1) with the full 53 bits of double precision
+	double nextDouble()
+	{
+		// two statements, the order of the calls inside one expression is unspecified
+		uint64_t high = nextUInt();
+		uint64_t low = nextUInt();
+		uint64_t bits = (high << 32) | low;
+		return (bits >> 11) * (1.0 / 9007199254740992.0);
+	}
+};
+
+// MurmurHash3 finalizer, spreads consecutive pixel and sample indices over the whole seed space
+inline uint64_t MixBits(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb93fe53ec5ebULL;
+	v ^= v >> 33;
+	return v;
+}
+
+// each thread owns its generator, the renderer reseeds it per (pixel, sample) so the
+// random sequence of a path never depends on which thread or in which order it was traced
+inline PCG32& ThreadGenerator()
+{
+	thread_local PCG32 generator;
+	return generator;
+}
+
+inline void SeedThreadGenerator(uint64_t pixel_index, uint64_t sample_index)
+{
+	ThreadGenerator().setSeed(MixBits(pixel_index * 0x9e3779b97f4a7c15ULL + sample_index), pixel_index);
+}
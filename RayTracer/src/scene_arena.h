@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+
+// owns the objects of one scene in a few large blocks: each allocation is a pointer bump, objects made one
+// after the other sit next to each other in memory, and the blocks are all released at once with the arena;
+// the shared_ptrs it hands out keep the usual ownership of the scene graph, their control block sits
+// right before the object and freeing it is a no-op, so the arena has to outlive every pointer it made
+class SceneArena
+{
+
+	std::pmr::monotonic_buffer_resource resource_;
+
+public:
+
+	explicit SceneArena(size_t initial_size = 1 << 16) : resource_(initial_size) {}
+
+	SceneArena(const SceneArena&) = delete;
+	SceneArena& operator=(const SceneArena&) = delete;
+
+	template <typename T, typename... Args>
+	std::shared_ptr<T> make(Args&&... args)
+	{
+		return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&resource_), std::forward<Args>(args)...);
+	}
+
+	// for containers that should live in the arena as well
+	std::pmr::memory_resource* getResource()
+	{
+		return &resource_;
+	}
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "utility.h"
+#include <deque>
+#include <mutex>
+
+class TileScheduler
+{
+
+public:
+
+	struct Tile
+	{
+		int x_min_, y_min_, x_max_, y_max_; // half open pixel range [min, max)
+	};
+
+private:
+
+	struct WorkerQueue
+	{
+		std::mutex mutex_;
+		std::deque<Tile> tiles_;
+	};
+
+	int thread_count_;
+	std::vector<WorkerQueue> queues_;
+
+	// the owner takes tiles from the front so it walks its own block in scanline order
+	bool pop(int worker, Tile& tile)
+	{
+		WorkerQueue& queue = queues_[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex_);
+		if (queue.tiles_.empty())
+			return false;
+		tile = queue.tiles_.front();
+		queue.tiles_.pop_front();
+		return true;
+	}
+
+	// thieves take tiles from the back, as far as possible from where the owner is working
+	bool steal(int thief, Tile& tile)
+	{
+		for (int i = 1; i < thread_count_; i++)
+		{
+			WorkerQueue& queue = queues_[(thief + i) % thread_count_];
+			std::lock_guard<std::mutex> lock(queue.mutex_);
+			if (queue.tiles_.empty())
+				continue;
+			tile = queue.tiles_.back();
+			queue.tiles_.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+public:
+
+	// thread_count <= 0 picks the number of hardware threads
+	TileScheduler(int width, int height, int tile_size, int thread_count)
+	{
+		if (thread_count <= 0)
+			thread_count = int(std::thread::hardware_concurrency());
+		thread_count_ = (thread_count < 1) ? 1 : thread_count;
+		tile_size = (tile_size < 1) ? 1 : tile_size;
+
+		std::vector<Tile> tiles;
+		for (int y = 0; y < height; y += tile_size)
+			for (int x = 0; x < width; x += tile_size)
+				tiles.push_back({ x, y, (x + tile_size < width) ? x + tile_size : width, (y + tile_size < height) ? y + tile_size : height });
+
+		// every worker starts with a contiguous block of tiles, stealing balances the rest at run time
+		queues_ = std::vector<WorkerQueue>(thread_count_);
+		size_t tile_count = tiles.size();
+		for (int worker = 0; worker < thread_count_; worker++)
+		{
+			size_t start = tile_count * worker / thread_count_, end = tile_count * (worker + 1) / thread_count_;
+			queues_[worker].tiles_.assign(tiles.begin() + start, tiles.begin() + end);
+		}
+	}
+
+	int getThreadCount() const
+	{
+		return thread_count_;
+	}
+
+	// calls render_tile(tile) for every tile exactly once, returns when all of them are done
+	template<typename Function>
+	void run(Function&& render_tile)
+	{
+		auto worker_loop = [this, &render_tile](int worker)
+			{
+				Tile tile;
+				// no tiles are ever added, so once every queue is empty the worker can leave
+				while (pop(worker, tile) || steal(worker, tile))
+					render_tile(tile);
+			};
+
+		std::vector<std::thread> workers;
+		for (int worker = 1; worker < thread_count_; worker++)
+			workers.emplace_back(worker_loop, worker);
+		worker_loop(0);
+
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+// instruction set detection and the helpers to compile wider kernels next to the baseline ones
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define RT_TARGET_AVX2 // msvc compiles any intrinsic without extra flags
+#define RT_TARGET_AVX2_EXACT // and never fuses a multiply and an add on its own
+#define RT_TARGET_F16C
+#else
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+// for kernels that have to match the scalar code bit for bit: without fma the compiler can't turn a * b + c into one rounding
+#define RT_TARGET_AVX2_EXACT __attribute__((target("avx2")))
+#define RT_TARGET_F16C __attribute__((target("avx,f16c")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define RT_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// true when the 8-wide AVX2 kernels can run on this machine, checked once at run time
+inline bool CpuSupportsAVX2()
+{
+#if defined(RT_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+	static const bool supported = []()
+		{
+			int info[4];
+			__cpuid(info, 1);
+			bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+			bool fma = info[2] & (1 << 12);
+			__cpuidex(info, 7, 0);
+			return os_saves_ymm && fma && (info[1] & (1 << 5));
+		}();
+	return supported;
+#elif defined(RT_SIMD_X86)
+	static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return supported;
+#else
+	return false;
+#endif
+}
+
+// true when half floats can be converted by the hardware, checked once at run time
+inline bool CpuSupportsF16C()
+{
+#if defined(RT_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+	static const bool supported = []()
+		{
+			int info[4];
+			__cpuid(info, 1);
+			bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+			return os_saves_ymm && (info[2] & (1 << 29));
+		}();
+	return supported;
+#elif defined(RT_SIMD_X86)
+	static const bool supported = __builtin_cpu_supports("f16c");
+	return supported;
+#else
+	return false;
+#endif
+}
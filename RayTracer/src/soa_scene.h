@@ -0,0 +1,442 @@
+#pragma once
+
+#include "linear_bvh.h"
+#include "simd.h"
+
+// spheres and quads copied into structure of arrays buffers, so a leaf tests up to 4 of them with one SIMD kernel;
+// the original objects stay alive for shading and light sampling, traversal only reads the arrays
+class SoAScene : public Hittable
+{
+
+	static const int stack_size_ = 64;
+	static const int lanes_ = 4; // doubles per AVX register, the arrays are padded so every batch can load 4
+
+	struct SphereArrays
+	{
+		std::vector<double> center_[3], motion_[3]; // the center at time t is center + t * motion
+		std::vector<double> radius2_;
+		std::vector<const Sphere*> objects_;
+	};
+
+	struct QuadArrays
+	{
+		std::vector<double> corner_[3], normal_[3];
+		// alpha = dot(p, alpha_axis) and beta = dot(p, beta_axis) for a point p relative to the corner,
+		// the same as Quad::intersect with the cross products precomputed
+		std::vector<double> alpha_axis_[3], beta_axis_[3];
+		std::vector<const Quad*> objects_;
+	};
+
+	// every leaf sorts its primitives by type, each type is a contiguous range of its arrays
+	struct Leaf
+	{
+		int32_t first_sphere_, first_quad_, first_other_;
+		uint8_t sphere_count_, quad_count_, other_count_;
+	};
+
+	// results of a batch, one entry per lane
+	struct BatchHits
+	{
+		alignas(32) double t_[lanes_];
+		alignas(32) double alpha_[lanes_];
+		alignas(32) double beta_[lanes_];
+	};
+
+	std::vector<LinearBVHNode> nodes_;
+	std::vector<Leaf> leaves_;
+	SphereArrays spheres_;
+	QuadArrays quads_;
+	std::vector<const Hittable*> others_; // anything else (instances, lists) keeps its virtual hit
+	std::vector<std::shared_ptr<Hittable>> primitives_; // owns the objects
+	AABB bounding_box_;
+	BVHStatistics statistics_;
+	bool use_avx2_;
+
+	// returns a bit per lane whose sphere is hit inside (t_min, t_max), the first count lanes starting at first are tested
+	static int hitSpheres(const SphereArrays& spheres, int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits)
+	{
+		double a = r.dir_.length2();
+		int mask = 0;
+		for (int lane = 0; lane < count; lane++)
+		{
+			int i = first + lane;
+			double oc[3];
+			for (int axis = 0; axis < 3; axis++)
+				oc[axis] = (spheres.center_[axis][i] + r.time_ * spheres.motion_[axis][i]) - r.orig_.data[axis];
+			double h = r.dir_.x * oc[0] + r.dir_.y * oc[1] + r.dir_.z * oc[2];
+			double c = (oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2]) - spheres.radius2_[i];
+			double discriminant = h * h - a * c;
+			if (discriminant < 0)
+				continue;
+			double root = std::sqrt(discriminant);
+			double t = (h - root) / a;
+			if (!(t > t_min && t < t_max))
+				t = (h + root) / a;
+			if (t > t_min && t < t_max)
+				hits.t_[lane] = t, mask |= 1 << lane;
+		}
+		return mask;
+	}
+
+	static int hitQuads(const QuadArrays& quads, int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits)
+	{
+		int mask = 0;
+		for (int lane = 0; lane < count; lane++)
+		{
+			int i = first + lane;
+			double denominator = quads.normal_[0][i] * r.dir_.x + quads.normal_[1][i] * r.dir_.y + quads.normal_[2][i] * r.dir_.z;
+			if (fabs(denominator) < 1e-8)
+				continue;
+			double t = (quads.normal_[0][i] * (quads.corner_[0][i] - r.orig_.x) + quads.normal_[1][i] * (quads.corner_[1][i] - r.orig_.y)
+				+ quads.normal_[2][i] * (quads.corner_[2][i] - r.orig_.z)) / denominator;
+			if (!(t >= t_min && t <= t_max))
+				continue;
+			double p[3], alpha = 0, beta = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				p[axis] = (r.orig_.data[axis] + t * r.dir_.data[axis]) - quads.corner_[axis][i];
+				alpha += p[axis] * quads.alpha_axis_[axis][i];
+				beta += p[axis] * quads.beta_axis_[axis][i];
+			}
+			if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1)
+				hits.t_[lane] = t, hits.alpha_[lane] = alpha, hits.beta_[lane] = beta, mask |= 1 << lane;
+		}
+		return mask;
+	}
+
+#if defined(RT_SIMD_X86)
+	RT_TARGET_AVX2 static int hitSpheresAVX2(const SphereArrays& spheres, int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits)
+	{
+		__m256d time = _mm256_set1_pd(r.time_);
+		__m256d oc[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256d center = _mm256_add_pd(_mm256_loadu_pd(&spheres.center_[axis][first]), _mm256_mul_pd(time, _mm256_loadu_pd(&spheres.motion_[axis][first])));
+			oc[axis] = _mm256_sub_pd(center, _mm256_set1_pd(r.orig_.data[axis]));
+		}
+		__m256d h = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(r.dir_.x), oc[0]), _mm256_mul_pd(_mm256_set1_pd(r.dir_.y), oc[1])),
+			_mm256_mul_pd(_mm256_set1_pd(r.dir_.z), oc[2]));
+		__m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], oc[0]), _mm256_mul_pd(oc[1], oc[1])), _mm256_mul_pd(oc[2], oc[2])),
+			_mm256_loadu_pd(&spheres.radius2_[first]));
+		__m256d a = _mm256_set1_pd(r.dir_.length2());
+		__m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(h, h), _mm256_mul_pd(a, c));
+		__m256d valid = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+
+		// lanes without a hit take the square root of a negative number, their NaN fails every comparison below
+		__m256d root = _mm256_sqrt_pd(discriminant);
+		__m256d lower = _mm256_set1_pd(t_min), upper = _mm256_set1_pd(t_max);
+		__m256d near_t = _mm256_div_pd(_mm256_sub_pd(h, root), a), far_t = _mm256_div_pd(_mm256_add_pd(h, root), a);
+		__m256d near_inside = _mm256_and_pd(_mm256_cmp_pd(near_t, lower, _CMP_GT_OQ), _mm256_cmp_pd(near_t, upper, _CMP_LT_OQ));
+		__m256d t = _mm256_blendv_pd(far_t, near_t, near_inside);
+		valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(t, lower, _CMP_GT_OQ), _mm256_cmp_pd(t, upper, _CMP_LT_OQ)));
+
+		_mm256_store_pd(hits.t_, t);
+		return _mm256_movemask_pd(valid) & ((1 << count) - 1);
+	}
+
+	RT_TARGET_AVX2 static int hitQuadsAVX2(const QuadArrays& quads, int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits)
+	{
+		__m256d denominator = _mm256_setzero_pd(), distance = _mm256_setzero_pd();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256d normal = _mm256_loadu_pd(&quads.normal_[axis][first]);
+			denominator = _mm256_add_pd(denominator, _mm256_mul_pd(normal, _mm256_set1_pd(r.dir_.data[axis])));
+			distance = _mm256_add_pd(distance, _mm256_mul_pd(normal, _mm256_sub_pd(_mm256_loadu_pd(&quads.corner_[axis][first]), _mm256_set1_pd(r.orig_.data[axis]))));
+		}
+		__m256d magnitude = _mm256_andnot_pd(_mm256_set1_pd(-0.0), denominator);
+		__m256d valid = _mm256_cmp_pd(magnitude, _mm256_set1_pd(1e-8), _CMP_GE_OQ);
+		__m256d t = _mm256_div_pd(distance, denominator);
+		valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(t, _mm256_set1_pd(t_min), _CMP_GE_OQ), _mm256_cmp_pd(t, _mm256_set1_pd(t_max), _CMP_LE_OQ)));
+
+		__m256d alpha = _mm256_setzero_pd(), beta = _mm256_setzero_pd();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256d p = _mm256_sub_pd(_mm256_add_pd(_mm256_set1_pd(r.orig_.data[axis]), _mm256_mul_pd(t, _mm256_set1_pd(r.dir_.data[axis]))),
+				_mm256_loadu_pd(&quads.corner_[axis][first]));
+			alpha = _mm256_add_pd(alpha, _mm256_mul_pd(p, _mm256_loadu_pd(&quads.alpha_axis_[axis][first])));
+			beta = _mm256_add_pd(beta, _mm256_mul_pd(p, _mm256_loadu_pd(&quads.beta_axis_[axis][first])));
+		}
+		__m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+		valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(alpha, zero, _CMP_GE_OQ), _mm256_cmp_pd(alpha, one, _CMP_LE_OQ)));
+		valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(beta, zero, _CMP_GE_OQ), _mm256_cmp_pd(beta, one, _CMP_LE_OQ)));
+
+		_mm256_store_pd(hits.t_, t);
+		_mm256_store_pd(hits.alpha_, alpha);
+		_mm256_store_pd(hits.beta_, beta);
+		return _mm256_movemask_pd(valid) & ((1 << count) - 1);
+	}
+#endif
+
+	int sphereBatch(int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits) const
+	{
+#if defined(RT_SIMD_X86)
+		if (use_avx2_)
+			return hitSpheresAVX2(spheres_, first, count, r, t_min, t_max, hits);
+#endif
+		return hitSpheres(spheres_, first, count, r, t_min, t_max, hits);
+	}
+
+	int quadBatch(int first, int count, const Ray& r, double t_min, double t_max, BatchHits& hits) const
+	{
+#if defined(RT_SIMD_X86)
+		if (use_avx2_)
+			return hitQuadsAVX2(quads_, first, count, r, t_min, t_max, hits);
+#endif
+		return hitQuads(quads_, first, count, r, t_min, t_max, hits);
+	}
+
+	bool hitLeaf(const Leaf& leaf, const Ray& r, Interval& ray_t, HitRecord& rec) const
+	{
+		bool hit_anything = false;
+		BatchHits hits;
+
+		for (int batch = 0; batch < leaf.sphere_count_; batch += lanes_)
+		{
+			int count = (leaf.sphere_count_ - batch < lanes_) ? leaf.sphere_count_ - batch : lanes_;
+			int mask = sphereBatch(leaf.first_sphere_ + batch, count, r, ray_t.min_, ray_t.max_, hits);
+			for (int lane = 0; mask; lane++, mask >>= 1)
+				if ((mask & 1) && hits.t_[lane] < ray_t.max_)
+				{
+					rec.t_ = ray_t.max_ = hits.t_[lane];
+					rec.object_ = spheres_.objects_[leaf.first_sphere_ + batch + lane];
+					hit_anything = true;
+				}
+		}
+
+		for (int batch = 0; batch < leaf.quad_count_; batch += lanes_)
+		{
+			int count = (leaf.quad_count_ - batch < lanes_) ? leaf.quad_count_ - batch : lanes_;
+			int mask = quadBatch(leaf.first_quad_ + batch, count, r, ray_t.min_, ray_t.max_, hits);
+			for (int lane = 0; mask; lane++, mask >>= 1)
+				if ((mask & 1) && hits.t_[lane] < ray_t.max_)
+				{
+					rec.t_ = ray_t.max_ = hits.t_[lane];
+					rec.u_ = hits.alpha_[lane];
+					rec.v_ = hits.beta_[lane];
+					rec.object_ = quads_.objects_[leaf.first_quad_ + batch + lane];
+					hit_anything = true;
+				}
+		}
+
+		for (int i = 0; i < leaf.other_count_; i++)
+			if (others_[leaf.first_other_ + i]->hit(r, ray_t, rec))
+			{
+				hit_anything = true;
+				ray_t.max_ = rec.t_;
+			}
+
+		return hit_anything;
+	}
+
+	bool occludedLeaf(const Leaf& leaf, const Ray& r, Interval ray_t) const
+	{
+		BatchHits hits;
+		for (int batch = 0; batch < leaf.sphere_count_; batch += lanes_)
+		{
+			int count = (leaf.sphere_count_ - batch < lanes_) ? leaf.sphere_count_ - batch : lanes_;
+			if (sphereBatch(leaf.first_sphere_ + batch, count, r, ray_t.min_, ray_t.max_, hits))
+				return true;
+		}
+		for (int batch = 0; batch < leaf.quad_count_; batch += lanes_)
+		{
+			int count = (leaf.quad_count_ - batch < lanes_) ? leaf.quad_count_ - batch : lanes_;
+			if (quadBatch(leaf.first_quad_ + batch, count, r, ray_t.min_, ray_t.max_, hits))
+				return true;
+		}
+		for (int i = 0; i < leaf.other_count_; i++)
+			if (others_[leaf.first_other_ + i]->occluded(r, ray_t))
+				return true;
+		return false;
+	}
+
+	void addSphere(const Sphere& sphere)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			spheres_.center_[axis].push_back(sphere.center_.orig_.data[axis]);
+			spheres_.motion_[axis].push_back(sphere.center_.dir_.data[axis]);
+		}
+		spheres_.radius2_.push_back(sphere.radius_ * sphere.radius_);
+		spheres_.objects_.push_back(&sphere);
+	}
+
+	void addQuad(const Quad& quad)
+	{
+		vec3 alpha_axis = cross(quad.v_, quad.w_), beta_axis = cross(quad.w_, quad.u_);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			quads_.corner_[axis].push_back(quad.corner_.data[axis]);
+			quads_.normal_[axis].push_back(quad.normal_.data[axis]);
+			quads_.alpha_axis_[axis].push_back(alpha_axis.data[axis]);
+			quads_.beta_axis_[axis].push_back(beta_axis.data[axis]);
+		}
+		quads_.objects_.push_back(&quad);
+	}
+
+	// the last batch of a leaf may read up to 3 entries past the end of the arrays
+	void padArrays()
+	{
+		for (int i = 0; i < lanes_ - 1; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				spheres_.center_[axis].push_back(0), spheres_.motion_[axis].push_back(0);
+				quads_.corner_[axis].push_back(0), quads_.normal_[axis].push_back(0);
+				quads_.alpha_axis_[axis].push_back(0), quads_.beta_axis_[axis].push_back(0);
+			}
+			spheres_.radius2_.push_back(0);
+		}
+	}
+
+public:
+
+	// leaves of up to 8 primitives fill two batches, so the build is told that a primitive test is cheap
+	static BVHBuildOptions defaultOptions()
+	{
+		BVHBuildOptions options;
+		options.max_leaf_size_ = 8;
+		options.intersection_cost_ = 0.5;
+		return options;
+	}
+
+	SoAScene(const HittableList& list, BVHBuildOptions options = defaultOptions()) : use_avx2_(CpuSupportsAVX2())
+	{
+		std::vector<AABB> bounds;
+		bounds.reserve(list.objects_.size());
+		for (const auto& object : list.objects_)
+			bounds.push_back(object->getBoundingBox());
+
+		// leaf counts per type have to fit in a byte
+		options.max_leaf_size_ = (options.max_leaf_size_ > 255) ? 255 : options.max_leaf_size_;
+		BVHBuilder builder(bounds, options);
+		if (builder.getStatistics().depth_ > stack_size_)
+		{
+			options.method_ = BVHBuildOptions::Method::Median;
+			builder = BVHBuilder(bounds, options);
+		}
+
+		const std::vector<BVHBuildNode>& build_nodes = builder.getNodes();
+		const std::vector<int>& order = builder.getPrimitiveOrder();
+		primitives_ = list.objects_;
+		nodes_.resize(build_nodes.size());
+		for (size_t i = 0; i < build_nodes.size(); i++)
+		{
+			const BVHBuildNode& build_node = build_nodes[i];
+			LinearBVHNode& node = nodes_[i];
+			node.setBounds(build_node.bounding_box_);
+			node.axis_ = uint8_t(build_node.axis_);
+			node.padding_ = 0;
+			if (!build_node.isLeaf())
+			{
+				node.offset_ = build_node.right_;
+				node.primitive_count_ = 0;
+				continue;
+			}
+
+			// the leaf's primitives are appended to the array of their type, so they stay contiguous
+			Leaf leaf = { int32_t(spheres_.objects_.size()), int32_t(quads_.objects_.size()), int32_t(others_.size()), 0, 0, 0 };
+			for (int k = 0; k < build_node.primitive_count_; k++)
+			{
+				const Hittable* object = list.objects_[order[build_node.first_primitive_ + k]].get();
+				if (const Sphere* sphere = dynamic_cast<const Sphere*>(object))
+					addSphere(*sphere), leaf.sphere_count_++;
+				else if (const Quad* quad = dynamic_cast<const Quad*>(object))
+					addQuad(*quad), leaf.quad_count_++;
+				else
+					others_.push_back(object), leaf.other_count_++;
+			}
+			node.offset_ = int32_t(leaves_.size());
+			node.primitive_count_ = uint16_t(build_node.primitive_count_);
+			leaves_.push_back(leaf);
+		}
+		padArrays();
+
+		bounding_box_ = build_nodes[0].bounding_box_;
+		statistics_ = builder.getStatistics();
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		if (primitives_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+		bool hit_anything = false;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ > 0)
+					hit_anything |= hitLeaf(leaves_[node.offset_], r, ray_t, rec);
+				else
+				{
+					if (r.sign_[node.axis_])
+					{
+						stack[stack_top++] = node_index + 1;
+						node_index = node.offset_;
+					}
+					else
+					{
+						stack[stack_top++] = node.offset_;
+						node_index = node_index + 1;
+					}
+					continue;
+				}
+			}
+
+			if (stack_top == 0)
+				break;
+			node_index = stack[--stack_top];
+		}
+
+		return hit_anything;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (primitives_.empty())
+			return false;
+
+		int stack[stack_size_];
+		int stack_top = 0, node_index = 0;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodes_[node_index];
+			if (node.hit(r, ray_t.min_, ray_t.max_))
+			{
+				if (node.primitive_count_ == 0)
+				{
+					stack[stack_top++] = node.offset_;
+					node_index = node_index + 1;
+					continue;
+				}
+				if (occludedLeaf(leaves_[node.offset_], r, ray_t))
+					return true;
+			}
+
+			if (stack_top == 0)
+				return false;
+			node_index = stack[--stack_top];
+		}
+	}
+
+	AABB getBoundingBox() const override
+	{
+		return bounding_box_;
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		for (const auto& primitive : primitives_)
+			primitive->collectLights(lights);
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+};
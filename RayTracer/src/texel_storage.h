@@ -0,0 +1,175 @@
+#pragma once
+
+#include "simd.h"
+#include "vec.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum class TexelFormat { Float32, Half };
+
+// RowMajor is the image order and has the cheapest index; Tiled keeps the texels of 4x4 blocks together, in Morton
+// order inside a block, so a bilinear lookup and its neighbors touch one or two cache lines whichever way the texture
+// is walked, which only pays off once the texture is much larger than the caches
+enum class TexelLayout { RowMajor, Tiled };
+
+// IEEE half precision, rounded to the nearest even; out of range values become infinity
+inline uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	uint16_t half;
+	if (bits >= (143u << 23)) // 2^16 and above, infinity and NaN
+	{
+		half = (bits > (255u << 23)) ? 0x7e00 : 0x7c00;
+	}
+	else if (bits < (113u << 23)) // below 2^-14 the result is denormal, adding 0.5 lines its mantissa up with the float's
+	{
+		float shifted;
+		std::memcpy(&shifted, &bits, sizeof(shifted));
+		shifted += 0.5f;
+		std::memcpy(&bits, &shifted, sizeof(bits));
+		half = uint16_t(bits - (126u << 23));
+	}
+	else
+	{
+		uint32_t odd_mantissa = (bits >> 13) & 1;
+		bits += (uint32_t(15 - 127) << 23) + 0xfff + odd_mantissa;
+		half = uint16_t(bits >> 13);
+	}
+	return half | uint16_t(sign >> 16);
+}
+
+// without branches, dark texels are often denormal and lookups at scattered positions would mispredict them
+inline float HalfToFloat(uint16_t half)
+{
+	uint32_t magnitude = half & 0x7fffu;
+	uint32_t bits = (magnitude << 13) + (uint32_t(127 - 15) << 23);
+	bits += (magnitude >= 0x7c00u) ? uint32_t(128 - 16) << 23 : 0; // infinity and NaN keep the largest exponent
+	float normal;
+	std::memcpy(&normal, &bits, sizeof(normal));
+	float value = (magnitude < 0x400u) ? float(int(magnitude)) * 5.9604644775390625e-08f : normal; // denormals are multiples of 2^-24
+
+	std::memcpy(&bits, &value, sizeof(bits));
+	bits |= uint32_t(half & 0x8000u) << 16;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+#ifdef RT_SIMD_X86
+// one instruction instead of the software decode, which at scattered positions holds up the cache misses behind it
+RT_TARGET_F16C inline Color HalfTexelToColorF16C(const uint16_t* texel)
+{
+	float channels[4];
+	_mm_storeu_ps(channels, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(texel))));
+	return Color(channels[0], channels[1], channels[2]);
+}
+#endif
+
+// the 3 halves of an rgb texel, with use_f16c a 4th one after them is read as well
+inline Color HalfTexelToColor(const uint16_t* texel, bool use_f16c)
+{
+#ifdef RT_SIMD_X86
+	if (use_f16c)
+		return HalfTexelToColorF16C(texel);
+#endif
+	return Color(HalfToFloat(texel[0]), HalfToFloat(texel[1]), HalfToFloat(texel[2]));
+}
+
+// the linear rgb texels of one image, at 12 (Float32) or 6 (Half) bytes per texel
+class TexelStorage
+{
+
+	static const int tile_size_ = 4; // getIndex relies on it
+
+	TexelFormat format_ = TexelFormat::Float32;
+	TexelLayout layout_ = TexelLayout::RowMajor;
+	int width_ = 0, height_ = 0;
+	int tiles_per_row_ = 0;
+	std::vector<float> floats_; // 3 per texel, only one of the two is used
+	std::vector<uint16_t> halves_; // with one more at the end, the hardware conversion loads 4 at a time
+	bool use_f16c_ = false;
+
+	size_t getIndex(int x, int y) const
+	{
+		if (layout_ == TexelLayout::RowMajor)
+			return size_t(y) * width_ + x;
+
+		// the tiles are 4x4, so the tile is in the upper bits of x and y and the position inside it in the lowest 2
+		unsigned column = unsigned(x), row = unsigned(y);
+		size_t tile = size_t(row >> 2) * tiles_per_row_ + (column >> 2);
+		// those interleaved: 2x2 quads first, then the 4 quads of the tile
+		unsigned morton = (column & 1) | ((row & 1) << 1) | ((column & 2) << 1) | ((row & 2) << 2);
+		return (tile << 4) | morton;
+	}
+
+public:
+
+	TexelStorage() = default;
+
+	TexelStorage(int width, int height, TexelFormat format = TexelFormat::Float32, TexelLayout layout = TexelLayout::RowMajor)
+		: format_(format), layout_(layout), width_(width), height_(height)
+	{
+		// partial tiles at the right and top edges are stored whole
+		tiles_per_row_ = (width_ + tile_size_ - 1) / tile_size_;
+		int tile_rows = (height_ + tile_size_ - 1) / tile_size_;
+		size_t texel_count = (layout_ == TexelLayout::Tiled) ? size_t(tiles_per_row_) * tile_rows * tile_size_ * tile_size_ : size_t(width_) * height_;
+
+		if (format_ == TexelFormat::Half)
+		{
+			halves_.resize(3 * texel_count + 1);
+			use_f16c_ = CpuSupportsF16C();
+		}
+		else
+			floats_.resize(3 * texel_count);
+	}
+
+	int width() const
+	{
+		return width_;
+	}
+
+	int height() const
+	{
+		return height_;
+	}
+
+	TexelFormat getFormat() const
+	{
+		return format_;
+	}
+
+	TexelLayout getLayout() const
+	{
+		return layout_;
+	}
+
+	size_t getByteSize() const
+	{
+		return floats_.size() * sizeof(float) + halves_.size() * sizeof(uint16_t);
+	}
+
+	// x and y have to be inside the image
+	Color get(int x, int y) const
+	{
+		size_t index = 3 * getIndex(x, y);
+		if (format_ == TexelFormat::Half)
+			return HalfTexelToColor(&halves_[index], use_f16c_);
+		return Color(floats_[index], floats_[index + 1], floats_[index + 2]);
+	}
+
+	void set(int x, int y, const Color& color)
+	{
+		size_t index = 3 * getIndex(x, y);
+		for (int channel = 0; channel < 3; channel++)
+		{
+			if (format_ == TexelFormat::Half)
+				halves_[index + channel] = FloatToHalf(float(color.data[channel]));
+			else
+				floats_[index + channel] = float(color.data[channel]);
+		}
+	}
+};
@@ -2,6 +2,9 @@
 
 #include "vec.h"
 #include "noise.h"
+#include "noise_volume.h"
+#include "mipmap.h"
+#include "texture_cache.h"
 
 class Texture
 {
@@ -9,6 +12,18 @@ public:
 
 	virtual ~Texture() = default;
 	virtual Color getValue(double u, double v, const vec3& point) const = 0;
+
+	// footprint is the width of the pixel's footprint around (u, v) in uv units (see HitRecord::footprint_),
+	// textures that can average over it do, the others return getValue
+	virtual Color getFilteredValue(double u, double v, const vec3& point, double footprint) const
+	{
+		return getValue(u, v, point);
+	}
+
+	virtual bool usesUV() const
+	{
+		return true;
+	}
 };
 
 class SolidTexture : public Texture
@@ -25,6 +40,11 @@ public:
 	{
 		return albedo_;
 	}
+
+	bool usesUV() const override
+	{
+		return false;
+	}
 };
 
 class CheckerTexture : public Texture
@@ -49,54 +69,118 @@ public:
 		
 		return (is_odd ? odd_->getValue(u, v, point) : even_->getValue(u, v, point));
 	}
+
+	Color getFilteredValue(double u, double v, const vec3& point, double footprint) const override
+	{
+		vec3 scaled_point = inverse_scale_ * point;
+		bool is_odd = int(floor(scaled_point.x) + floor(scaled_point.y) + floor(scaled_point.z)) % 2;
+
+		return (is_odd ? odd_->getFilteredValue(u, v, point, footprint) : even_->getFilteredValue(u, v, point, footprint));
+	}
+
+	// the pattern itself is spatial, only the two sub textures may need u, v
+	bool usesUV() const override
+	{
+		return even_->usesUV() || odd_->usesUV();
+	}
 };
 
 class ImageTexture : public Texture
 {
 
-	TGAImage image_;
+	MipMap mip_map_; // in linear color, the image file is only needed while it is built
 
 public:
 
-	ImageTexture(const char* image_path)
+	// Half storage takes half the memory and keeps about 3 significant digits, plenty for 8 bit images;
+	// the Tiled layout is for images much larger than the caches
+	ImageTexture(const char* image_path, TexelFormat format = TexelFormat::Float32, TexelLayout layout = TexelLayout::RowMajor)
 	{
-		if (!image_.read_tga_file(image_path))
+		TGAImage image;
+		if (!image.read_tga_file(image_path))
 		{
 			std::cerr << "Couldn't load the image with path : " << image_path << '\n';
 			return;
 		}
-		for (int i = 0; i < image_.width(); i++)
-			for (int j = 0; j < image_.height(); j++)
-			{ // converting colors from gamma space to linear space
-				Color pixel_color = toColor(image_.get(i, j));
-				image_.set(i, j, toTGAColor(gammaToLinear(pixel_color)));
-			}
-		image_.flip_vertically();
+		image.flip_vertically();
+		mip_map_ = MipMap(image, format, layout);
 	}
 
 	Color getValue(double u, double v, const vec3& point) const override
 	{
-		if (!image_.width() || !image_.height())
+		if (mip_map_.empty())
 			return Color(0, 1, 1);
 
-		u = Interval(0, 1).clamp(u), v = Interval(0, 1).clamp(v);
-		int i = u * (image_.width() - 1), j = v * (image_.height() - 1);
+		return mip_map_.getValue(u, v);
+	}
+
+	Color getFilteredValue(double u, double v, const vec3& point, double footprint) const override
+	{
+		if (mip_map_.empty())
+			return Color(0, 1, 1);
 
-		return toColor(image_.get(i, j));
+		return mip_map_.getValue(u, v, footprint);
+	}
+};
+
+// an image read through a shared TextureCache, so only the tiles that shading reaches are in memory
+class CachedImageTexture : public Texture
+{
+
+	std::shared_ptr<TextureCache> cache_;
+	int texture_id_;
+
+public:
+
+	CachedImageTexture(std::shared_ptr<TextureCache> cache, const char* image_path) : cache_(std::move(cache))
+	{
+		texture_id_ = cache_->addTexture(image_path);
+	}
+
+	Color getValue(double u, double v, const vec3& point) const override
+	{
+		if (texture_id_ < 0)
+			return Color(0, 1, 1);
+
+		return cache_->getValue(texture_id_, u, v, 0);
+	}
+
+	Color getFilteredValue(double u, double v, const vec3& point, double footprint) const override
+	{
+		if (texture_id_ < 0)
+			return Color(0, 1, 1);
+
+		return cache_->getValue(texture_id_, u, v, footprint);
 	}
 };
 
 class NoiseTexture : public Texture
 {
 
+	static const int turbulence_depth_ = 7;
+
 	double scale_;
 	std::shared_ptr<Noise> noise_;
+	std::shared_ptr<NoiseVolume> volume_;
 public:
 
 	NoiseTexture(std::shared_ptr<Noise> noise, double scale) : noise_(noise), scale_(scale) {}
 
+	// samples the turbulence into a grid when the scene is set up, shading then interpolates the grid
+	const NoiseVolume& bake(const NoiseVolumeOptions& options = NoiseVolumeOptions())
+	{
+		volume_ = std::make_shared<NoiseVolume>(noise_, turbulence_depth_, options);
+		return *volume_;
+	}
+
 	Color getValue(double u, double v, const vec3& point) const override
 	{
-		return Color(0.5, 0.5, 0.5) * (1.0 + sin(scale_ * point.x + 10.0 * noise_->getTurbuelence(point, 7)));
+		double turbulence = volume_ ? volume_->getTurbulence(point) : noise_->getTurbuelence(point, turbulence_depth_);
+		return Color(0.5, 0.5, 0.5) * (1.0 + sin(scale_ * point.x + 10.0 * turbulence));
+	}
+
+	bool usesUV() const override
+	{
+		return false;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,465 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "mipmap.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+struct TextureCacheOptions
+{
+	size_t memory_budget_ = size_t(256) << 20; // in bytes, tiles beyond it evict the least recently used ones
+	int tile_size_ = 64; // texels per side of a tile, rounded up to a power of two
+	TexelFormat format_ = TexelFormat::Half; // of the tiled files and of the tiles in memory
+};
+
+struct TextureCacheStatistics
+{
+	long long hits_ = 0; // tile lookups that found the tile in memory right away
+	long long misses_ = 0; // tiles read from their file
+	long long evictions_ = 0;
+	int resident_tiles_ = 0;
+	int capacity_ = 0; // tiles that fit in the memory budget
+	size_t memory_bytes_ = 0; // of the resident tiles
+
+	void print(std::ostream& out) const
+	{
+		long long lookups = hits_ + misses_;
+		out << "Texture cache: " << hits_ << " hits, " << misses_ << " misses (" << (lookups ? 100.0 * hits_ / lookups : 0.0) << "% hits), "
+			<< evictions_ << " evictions, " << resident_tiles_ << " of " << capacity_ << " tiles resident, " << memory_bytes_ / double(1 << 20) << "MB\n";
+	}
+};
+
+// textures kept on disk as mip mapped tiles, of which only the recently used ones stay in memory; the tiles of an image
+// are written once to "<image path>.tiles" and from then on the image itself is never loaded again. the file is mapped
+// and a miss copies its tile into one of the slots the memory budget allows, so the budget bounds what the cache holds
+// however large the files are. lookups of resident tiles take no lock: a reader pins the slot with one atomic add and
+// checks it still holds the tile, a slot is only refilled when its pin count can be swapped for the locked bit. misses
+// take a mutex to pick a victim and copy the tile after releasing it, so tiles of different lookups load in parallel
+class TextureCache
+{
+
+	static const uint32_t file_version_ = 2; // 2: odd sizes round up when halved
+	static const size_t file_alignment_ = 4096; // the tiles of a file start at a page boundary
+	static const uint32_t locked_ = 0x80000000u; // in a slot's pin count while its tile is replaced
+	static const int empty_ = -1, loading_ = -2; // tile table entries besides a slot index
+	static const int counter_stripes_ = 16;
+
+	struct FileHeader
+	{
+		char magic_[8];
+		uint32_t version_;
+		uint32_t format_;
+		uint32_t tile_size_;
+		uint32_t level_count_; // followed by the width and height of every level as uint32_t
+	};
+
+	struct Level
+	{
+		int width_, height_;
+		int tiles_per_row_;
+		int first_tile_; // of the level in the tile table and in the file
+	};
+
+	struct TiledTexture
+	{
+		int id_;
+		std::unique_ptr<MappedFile> file_;
+		size_t data_offset_;
+		std::vector<Level> levels_;
+		std::unique_ptr<std::atomic<int>[]> tile_slots_; // the slot of every tile, empty_ or loading_
+	};
+
+	struct Slot
+	{
+		std::atomic<uint32_t> pins_{ 0 }; // readers of the tile, or locked_ and readers backing off
+		std::atomic<uint8_t> referenced_{ 0 }; // set by every hit, cleared when the clock hand passes
+		int texture_ = empty_, tile_ = empty_; // only changed while locked
+	};
+
+	// hits are counted by every lookup, on one of a few cache lines so the threads don't contend for it
+	struct alignas(64) Counter
+	{
+		std::atomic<long long> value_{ 0 };
+	};
+
+	TextureCacheOptions options_;
+	int tile_shift_;
+	size_t tile_bytes_;
+	size_t slot_bytes_; // a cache line more, the hardware half conversion reads past the last texel of a tile
+	int slot_count_;
+	std::unique_ptr<Slot[]> slots_;
+	std::unique_ptr<unsigned char[]> memory_; // slot after slot, uninitialized so the pages of unused slots stay untouched
+	bool use_f16c_;
+	std::vector<std::unique_ptr<TiledTexture>> textures_;
+
+	mutable std::mutex miss_mutex_; // guards the clock hand and the owners of unlocked slots
+	mutable int clock_hand_ = 0;
+	mutable Counter hits_[counter_stripes_];
+	mutable std::atomic<long long> misses_{ 0 }, evictions_{ 0 };
+	mutable std::atomic<int> resident_tiles_{ 0 };
+
+	static int getStripe()
+	{
+		static std::atomic<int> next_stripe{ 0 };
+		thread_local int stripe = next_stripe++ % counter_stripes_;
+		return stripe;
+	}
+
+	size_t getTexelCount() const
+	{
+		return size_t(1) << (2 * tile_shift_);
+	}
+
+	// x and y are inside the tile
+	Color readTexel(int slot, int x, int y) const
+	{
+		size_t index = 3 * ((size_t(y) << tile_shift_) + x);
+		const unsigned char* tile = &memory_[size_t(slot) * slot_bytes_];
+		if (options_.format_ == TexelFormat::Half)
+			return HalfTexelToColor(reinterpret_cast<const uint16_t*>(tile) + index, use_f16c_);
+		const float* texel = reinterpret_cast<const float*>(tile) + index;
+		return Color(texel[0], texel[1], texel[2]);
+	}
+
+	// the clock sweep approximates least recently used: a slot that was read since the hand last passed it gets
+	// another round, the first other one that no thread is reading is locked and returned
+	int lockVictim() const
+	{
+		for (int step = 1; ; step++)
+		{
+			int index = clock_hand_;
+			Slot& slot = slots_[index];
+			clock_hand_ = (clock_hand_ + 1 == slot_count_) ? 0 : clock_hand_ + 1;
+
+			if (slot.referenced_.load(std::memory_order_relaxed))
+			{
+				slot.referenced_.store(0, std::memory_order_relaxed);
+				continue;
+			}
+			uint32_t expected = 0;
+			if (slot.pins_.compare_exchange_strong(expected, locked_, std::memory_order_acquire))
+				return index;
+			if (step % slot_count_ == 0) // every slot is being read, pins only last a few loads
+				std::this_thread::yield();
+		}
+	}
+
+	// copies the tile into a slot unless another thread is already at it; the lookup is retried either way
+	void loadTile(const TiledTexture& texture, int tile) const
+	{
+		std::atomic<int>& entry = texture.tile_slots_[tile];
+		int index;
+		{
+			std::lock_guard<std::mutex> lock(miss_mutex_);
+			if (entry.load(std::memory_order_acquire) != empty_)
+				return;
+			entry.store(loading_, std::memory_order_relaxed);
+
+			index = lockVictim();
+			Slot& slot = slots_[index];
+			if (slot.texture_ != empty_)
+			{
+				textures_[slot.texture_]->tile_slots_[slot.tile_].store(empty_, std::memory_order_relaxed);
+				evictions_++;
+			}
+			else
+			{
+				resident_tiles_++;
+			}
+			slot.texture_ = texture.id_;
+			slot.tile_ = tile;
+		}
+
+		std::memcpy(&memory_[size_t(index) * slot_bytes_], texture.file_->begin() + texture.data_offset_ + size_t(tile) * tile_bytes_, tile_bytes_);
+		misses_++;
+
+		// published before the slot is unlocked, once it is the next miss may evict the tile and has to find it
+		Slot& slot = slots_[index];
+		slot.referenced_.store(1, std::memory_order_relaxed);
+		entry.store(index, std::memory_order_release);
+		slot.pins_.fetch_and(~locked_, std::memory_order_release); // readers that backed off meanwhile keep their counts
+	}
+
+	// the slot holding the tile, pinned until unpin
+	int pinTile(const TiledTexture& texture, int tile) const
+	{
+		for (bool waited = false; ; waited = true)
+		{
+			int index = texture.tile_slots_[tile].load(std::memory_order_acquire);
+			if (index >= 0)
+			{
+				Slot& slot = slots_[index];
+				uint32_t pins = slot.pins_.fetch_add(1, std::memory_order_acquire);
+				if (!(pins & locked_) && slot.texture_ == texture.id_ && slot.tile_ == tile)
+				{
+					if (!slot.referenced_.load(std::memory_order_relaxed))
+						slot.referenced_.store(1, std::memory_order_relaxed);
+					if (!waited)
+						hits_[getStripe()].value_.fetch_add(1, std::memory_order_relaxed);
+					return index;
+				}
+				slot.pins_.fetch_sub(1, std::memory_order_release);
+				if (pins & locked_) // the tile is still being copied
+					std::this_thread::yield();
+			}
+			else if (index == loading_)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				loadTile(texture, tile);
+			}
+		}
+	}
+
+	void unpin(int slot) const
+	{
+		slots_[slot].pins_.fetch_sub(1, std::memory_order_release);
+	}
+
+	// the texel of a level, clamped to its size
+	Color getTexel(const TiledTexture& texture, const Level& level, int x, int y) const
+	{
+		x = (x < 0) ? 0 : (x >= level.width_) ? level.width_ - 1 : x;
+		y = (y < 0) ? 0 : (y >= level.height_) ? level.height_ - 1 : y;
+		int mask = (1 << tile_shift_) - 1;
+		int slot = pinTile(texture, level.first_tile_ + (y >> tile_shift_) * level.tiles_per_row_ + (x >> tile_shift_));
+		Color texel = readTexel(slot, x & mask, y & mask);
+		unpin(slot);
+		return texel;
+	}
+
+	// the same filter as MipMap::getBilinear; the 2x2 texels are read under one pin when they share a tile
+	Color getBilinear(const TiledTexture& texture, int level_index, double u, double v) const
+	{
+		const Level& level = texture.levels_[level_index];
+		u = IntervalT<double>(0, 1).clamp(u), v = IntervalT<double>(0, 1).clamp(v);
+		double x = u * (level.width_ - 1), y = v * (level.height_ - 1);
+		int x0 = int(x), y0 = int(y);
+		double tx = x - x0, ty = y - y0;
+
+		Color texels[4];
+		int mask = (1 << tile_shift_) - 1;
+		int x1 = (x0 + 1 < level.width_) ? x0 + 1 : x0, y1 = (y0 + 1 < level.height_) ? y0 + 1 : y0;
+		if ((x0 >> tile_shift_) == (x1 >> tile_shift_) && (y0 >> tile_shift_) == (y1 >> tile_shift_))
+		{
+			int slot = pinTile(texture, level.first_tile_ + (y0 >> tile_shift_) * level.tiles_per_row_ + (x0 >> tile_shift_));
+			texels[0] = readTexel(slot, x0 & mask, y0 & mask);
+			texels[1] = readTexel(slot, x1 & mask, y0 & mask);
+			texels[2] = readTexel(slot, x0 & mask, y1 & mask);
+			texels[3] = readTexel(slot, x1 & mask, y1 & mask);
+			unpin(slot);
+		}
+		else
+		{
+			texels[0] = getTexel(texture, level, x0, y0);
+			texels[1] = getTexel(texture, level, x1, y0);
+			texels[2] = getTexel(texture, level, x0, y1);
+			texels[3] = getTexel(texture, level, x1, y1);
+		}
+
+		Color bottom = Lerp(texels[0], texels[1], tx);
+		Color top = Lerp(texels[2], texels[3], tx);
+		return Lerp(bottom, top, ty);
+	}
+
+	// the levels of the image in the cache's format, tile after tile with the texels of every tile in rows;
+	// texels of the edge tiles that are outside the level are left zero
+	bool writeTiledFile(const char* image_path, const std::string& tiled_path) const
+	{
+		TGAImage image;
+		if (!image.read_tga_file(image_path))
+		{
+			std::cerr << "Couldn't load the image with path : " << image_path << '\n';
+			return false;
+		}
+		image.flip_vertically();
+
+		TexelStorage level(image.width(), image.height(), options_.format_);
+		for (int y = 0; y < level.height(); y++)
+			for (int x = 0; x < level.width(); x++)
+				level.set(x, y, gammaToLinear(toColor(image.get(x, y))));
+		image = TGAImage();
+
+		std::vector<uint32_t> sizes;
+		for (uint32_t width = level.width(), height = level.height(); ; width = (width + 1) / 2, height = (height + 1) / 2) // as MipMap::getHalved
+		{
+			sizes.push_back(width);
+			sizes.push_back(height);
+			if (width == 1 && height == 1)
+				break;
+		}
+
+		std::ofstream out(tiled_path, std::ios::binary);
+		if (!out)
+		{
+			std::cerr << "Couldn't write the tiled texture with path : " << tiled_path << '\n';
+			return false;
+		}
+		FileHeader header = { "RTTILES", file_version_, uint32_t(options_.format_), uint32_t(1) << tile_shift_, uint32_t(sizes.size() / 2) };
+		std::vector<char> padding((file_alignment_ - (sizeof(header) + sizes.size() * sizeof(uint32_t)) % file_alignment_) % file_alignment_, 0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(sizes.data()), sizes.size() * sizeof(uint32_t));
+		out.write(padding.data(), padding.size());
+
+		int tile_size = 1 << tile_shift_;
+		std::vector<unsigned char> tile(tile_bytes_);
+		for (;;)
+		{
+			for (int tile_y = 0; tile_y < level.height(); tile_y += tile_size)
+			{
+				for (int tile_x = 0; tile_x < level.width(); tile_x += tile_size)
+				{
+					std::fill(tile.begin(), tile.end(), 0);
+					for (int y = tile_y; y < tile_y + tile_size && y < level.height(); y++)
+					{
+						for (int x = tile_x; x < tile_x + tile_size && x < level.width(); x++)
+						{
+							Color texel = level.get(x, y);
+							size_t index = 3 * ((size_t(y - tile_y) << tile_shift_) + (x - tile_x));
+							for (int channel = 0; channel < 3; channel++)
+							{
+								if (options_.format_ == TexelFormat::Half)
+									reinterpret_cast<uint16_t*>(tile.data())[index + channel] = FloatToHalf(float(texel.data[channel]));
+								else
+									reinterpret_cast<float*>(tile.data())[index + channel] = float(texel.data[channel]);
+							}
+						}
+					}
+					out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+				}
+			}
+			if (level.width() == 1 && level.height() == 1)
+				break;
+			level = MipMap::getHalved(level);
+		}
+
+		if (!out)
+		{
+			std::cerr << "Couldn't write the tiled texture with path : " << tiled_path << '\n';
+			return false;
+		}
+		return true;
+	}
+
+	// maps the file and reads its levels, false when it isn't a complete tiled file with this cache's format
+	bool openTiledFile(const std::string& tiled_path, TiledTexture& texture) const
+	{
+		texture.file_ = std::make_unique<MappedFile>(tiled_path.c_str(), MappedFile::Access::Random);
+		const MappedFile& file = *texture.file_;
+		FileHeader header;
+		if (!file.isOpen() || file.size() < sizeof(header))
+			return false;
+		std::memcpy(&header, file.begin(), sizeof(header));
+		if (std::memcmp(header.magic_, "RTTILES", 8) || header.version_ != file_version_ || header.format_ != uint32_t(options_.format_)
+			|| header.tile_size_ != (uint32_t(1) << tile_shift_) || header.level_count_ == 0 || header.level_count_ > 32)
+			return false;
+
+		size_t sizes_end = sizeof(header) + header.level_count_ * 2 * sizeof(uint32_t);
+		if (file.size() < sizes_end)
+			return false;
+		std::vector<uint32_t> sizes(header.level_count_ * 2);
+		std::memcpy(sizes.data(), file.begin() + sizeof(header), sizes.size() * sizeof(uint32_t));
+
+		texture.levels_.clear();
+		int tile_count = 0;
+		for (uint32_t i = 0; i < header.level_count_; i++)
+		{
+			Level level;
+			level.width_ = int(sizes[2 * i]), level.height_ = int(sizes[2 * i + 1]);
+			if (level.width_ <= 0 || level.height_ <= 0)
+				return false;
+			level.tiles_per_row_ = ((level.width_ - 1) >> tile_shift_) + 1;
+			level.first_tile_ = tile_count;
+			tile_count += level.tiles_per_row_ * (((level.height_ - 1) >> tile_shift_) + 1);
+			texture.levels_.push_back(level);
+		}
+
+		texture.data_offset_ = (sizes_end + file_alignment_ - 1) / file_alignment_ * file_alignment_;
+		if (file.size() < texture.data_offset_ + size_t(tile_count) * tile_bytes_)
+			return false;
+
+		texture.tile_slots_.reset(new std::atomic<int>[tile_count]);
+		for (int i = 0; i < tile_count; i++)
+			texture.tile_slots_[i].store(empty_, std::memory_order_relaxed);
+		return true;
+	}
+
+public:
+
+	explicit TextureCache(const TextureCacheOptions& options = TextureCacheOptions()) : options_(options), use_f16c_(CpuSupportsF16C())
+	{
+		for (tile_shift_ = 0; (1 << tile_shift_) < options_.tile_size_ && tile_shift_ < 12; tile_shift_++);
+		options_.tile_size_ = 1 << tile_shift_;
+		tile_bytes_ = getTexelCount() * 3 * ((options_.format_ == TexelFormat::Half) ? sizeof(uint16_t) : sizeof(float));
+
+		slot_bytes_ = tile_bytes_ + 64;
+
+		size_t slot_count = options_.memory_budget_ / slot_bytes_;
+		slot_count_ = (slot_count < 1) ? 1 : (slot_count > (size_t(1) << 30)) ? 1 << 30 : int(slot_count);
+		slots_.reset(new Slot[slot_count_]);
+		memory_.reset(new unsigned char[size_t(slot_count_) * slot_bytes_]);
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// textures are added while the scene is set up, lookups can then come from any number of threads; the tiled
+	// file is written when it is missing, older than the image or made with other options. returns the id to look
+	// the texture up with, or -1 when neither the image nor a tiled file could be read
+	int addTexture(const char* image_path)
+	{
+		std::string tiled_path = std::string(image_path) + ".tiles";
+		long long image_time = 0, tiled_time = 0;
+		bool has_image = GetModificationTime(image_path, image_time);
+		bool current = GetModificationTime(tiled_path.c_str(), tiled_time) && (!has_image || tiled_time >= image_time);
+
+		auto texture = std::make_unique<TiledTexture>();
+		texture->id_ = int(textures_.size());
+		if (!current || !openTiledFile(tiled_path, *texture))
+		{
+			texture->file_.reset(); // unmapped before it is overwritten
+			if (!writeTiledFile(image_path, tiled_path))
+				return -1;
+			if (!openTiledFile(tiled_path, *texture))
+			{
+				std::cerr << "Couldn't read the tiled texture with path : " << tiled_path << '\n';
+				return -1;
+			}
+		}
+		textures_.push_back(std::move(texture));
+		return textures_.back()->id_;
+	}
+
+	// trilinear like MipMap::getValue, footprint is the width of the area to average in uv units
+	Color getValue(int texture_id, double u, double v, double footprint) const
+	{
+		const TiledTexture& texture = *textures_[texture_id];
+		double level = MipMap::getLevel(footprint, texture.levels_[0].width_, texture.levels_[0].height_);
+		if (level <= 0)
+			return getBilinear(texture, 0, u, v);
+
+		int last = int(texture.levels_.size()) - 1;
+		if (level >= last)
+			return getBilinear(texture, last, u, v);
+
+		int lower = int(level);
+		return Lerp(getBilinear(texture, lower, u, v), getBilinear(texture, lower + 1, u, v), level - lower);
+	}
+
+	TextureCacheStatistics getStatistics() const
+	{
+		TextureCacheStatistics statistics;
+		for (const Counter& counter : hits_)
+			statistics.hits_ += counter.value_.load(std::memory_order_relaxed);
+		statistics.misses_ = misses_.load();
+		statistics.evictions_ = evictions_.load();
+		statistics.resident_tiles_ = resident_tiles_.load();
+		statistics.capacity_ = slot_count_;
+		statistics.memory_bytes_ = size_t(statistics.resident_tiles_) * slot_bytes_;
+		return statistics;
+	}
+};
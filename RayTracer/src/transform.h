@@ -0,0 +1,148 @@
+#pragma once
+
+#include "aabb.h"
+
+// an affine transform as the top 3 rows of a 4x4 matrix, points use the translation column, vectors don't
+class Transform
+{
+
+public:
+
+	double m_[3][4];
+
+	Transform()
+	{
+		for (int row = 0; row < 3; row++)
+			for (int column = 0; column < 4; column++)
+				m_[row][column] = (row == column) ? 1 : 0;
+	}
+
+	static Transform Translation(const vec3& offset)
+	{
+		Transform transform;
+		for (int row = 0; row < 3; row++)
+			transform.m_[row][3] = offset.data[row];
+		return transform;
+	}
+
+	static Transform Scale(const vec3& factors)
+	{
+		Transform transform;
+		for (int row = 0; row < 3; row++)
+			transform.m_[row][row] = factors.data[row];
+		return transform;
+	}
+
+	// the same rotation as RotateY
+	static Transform RotationY(double angle)
+	{
+		double radians_angle = DegreesToRadians(angle), cosine = cos(radians_angle), sine = sin(radians_angle);
+		Transform transform;
+		transform.m_[0][0] = cosine, transform.m_[0][2] = sine;
+		transform.m_[2][0] = -sine, transform.m_[2][2] = cosine;
+		return transform;
+	}
+
+	static Transform RotationX(double angle)
+	{
+		double radians_angle = DegreesToRadians(angle), cosine = cos(radians_angle), sine = sin(radians_angle);
+		Transform transform;
+		transform.m_[1][1] = cosine, transform.m_[1][2] = -sine;
+		transform.m_[2][1] = sine, transform.m_[2][2] = cosine;
+		return transform;
+	}
+
+	static Transform RotationZ(double angle)
+	{
+		double radians_angle = DegreesToRadians(angle), cosine = cos(radians_angle), sine = sin(radians_angle);
+		Transform transform;
+		transform.m_[0][0] = cosine, transform.m_[0][1] = -sine;
+		transform.m_[1][0] = sine, transform.m_[1][1] = cosine;
+		return transform;
+	}
+
+	// (a * b) applies b first
+	friend Transform operator*(const Transform& a, const Transform& b)
+	{
+		Transform result;
+		for (int row = 0; row < 3; row++)
+			for (int column = 0; column < 4; column++)
+			{
+				double value = (column == 3) ? a.m_[row][3] : 0;
+				for (int k = 0; k < 3; k++)
+					value += a.m_[row][k] * b.m_[k][column];
+				result.m_[row][column] = value;
+			}
+		return result;
+	}
+
+	vec3 point(const vec3& p) const
+	{
+		return vec3(m_[0][0] * p.x + m_[0][1] * p.y + m_[0][2] * p.z + m_[0][3],
+			m_[1][0] * p.x + m_[1][1] * p.y + m_[1][2] * p.z + m_[1][3],
+			m_[2][0] * p.x + m_[2][1] * p.y + m_[2][2] * p.z + m_[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const
+	{
+		return vec3(m_[0][0] * v.x + m_[0][1] * v.y + m_[0][2] * v.z,
+			m_[1][0] * v.x + m_[1][1] * v.y + m_[1][2] * v.z,
+			m_[2][0] * v.x + m_[2][1] * v.y + m_[2][2] * v.z);
+	}
+
+	// normals go through the inverse transpose, so this is called on the inverse of the transform moving the points
+	vec3 normalFromInverse(const vec3& n) const
+	{
+		return vec3(m_[0][0] * n.x + m_[1][0] * n.y + m_[2][0] * n.z,
+			m_[0][1] * n.x + m_[1][1] * n.y + m_[2][1] * n.z,
+			m_[0][2] * n.x + m_[1][2] * n.y + m_[2][2] * n.z);
+	}
+
+	// how much the transform scales volumes, negative when it mirrors
+	double determinant() const
+	{
+		return m_[0][0] * (m_[1][1] * m_[2][2] - m_[1][2] * m_[2][1])
+			- m_[0][1] * (m_[1][0] * m_[2][2] - m_[1][2] * m_[2][0])
+			+ m_[0][2] * (m_[1][0] * m_[2][1] - m_[1][1] * m_[2][0]);
+	}
+
+	// singular transforms (a zero scale) have no inverse, the result is then filled with infinities
+	Transform inverse() const
+	{
+		double cofactor[3][3];
+		for (int row = 0; row < 3; row++)
+			for (int column = 0; column < 3; column++)
+			{
+				int r0 = (row + 1) % 3, r1 = (row + 2) % 3, c0 = (column + 1) % 3, c1 = (column + 2) % 3;
+				cofactor[row][column] = m_[r0][c0] * m_[r1][c1] - m_[r0][c1] * m_[r1][c0];
+			}
+		double determinant = m_[0][0] * cofactor[0][0] + m_[0][1] * cofactor[0][1] + m_[0][2] * cofactor[0][2];
+
+		Transform result;
+		for (int row = 0; row < 3; row++)
+			for (int column = 0; column < 3; column++)
+				result.m_[row][column] = cofactor[column][row] / determinant;
+		for (int row = 0; row < 3; row++)
+			result.m_[row][3] = -(result.m_[row][0] * m_[0][3] + result.m_[row][1] * m_[1][3] + result.m_[row][2] * m_[2][3]);
+		return result;
+	}
+
+	// the box around the 8 transformed corners
+	AABB box(const AABB& bounding_box) const
+	{
+		vec3 minimum(Infinity, Infinity, Infinity), maximum(-Infinity, -Infinity, -Infinity);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			vec3 p((corner & 1) ? bounding_box.x_.max_ : bounding_box.x_.min_,
+				(corner & 2) ? bounding_box.y_.max_ : bounding_box.y_.min_,
+				(corner & 4) ? bounding_box.z_.max_ : bounding_box.z_.min_);
+			p = point(p);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				minimum.data[axis] = std::fmin(minimum.data[axis], p.data[axis]);
+				maximum.data[axis] = std::fmax(maximum.data[axis], p.data[axis]);
+			}
+		}
+		return AABB(minimum, maximum);
+	}
+};
@@ -9,10 +9,18 @@
 #include <memory>
 #include <windows.h>
 #include <thread>
-#include <execution>
+#include "rng.h"
 const double Infinity = std::numeric_limits<double>::infinity();
 const double Pi = 3.1415926535897932385;
 
+// the scalar of the geometry (Vec3, Ray, Interval, AABB): defining RAYTRACER_FLOAT halves their memory traffic
+// and doubles the SIMD width, colors and their accumulation stay in double either way
+#ifdef RAYTRACER_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+
 inline double RadiansToDegrees(double angle)
 {
 	return 180 / Pi * angle;
@@ -25,7 +33,7 @@ inline double DegreesToRadians(double angle)
 
 inline double RandomDouble(double min = 0, double max = 1)
 {
-	return min + (max - min) * std::rand() / (RAND_MAX + 1.0f);
+	return min + (max - min) * ThreadGenerator().nextDouble();
 }
 
 inline int RandomInteger(int min = 0, int max = 1)
@@ -51,4 +59,11 @@ inline double Smoothstep(double min, double max, double t)
 inline double Smootherstep(double t)
 {
 	return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+// multiple importance sampling weight of a sample drawn with pdf, when other_pdf could have drawn it too
+inline double PowerHeuristic(double pdf, double other_pdf)
+{
+	double a = pdf * pdf, b = other_pdf * other_pdf;
+	return (a + b > 0) ? a / (a + b) : 0;
 }
\ No newline at end of file
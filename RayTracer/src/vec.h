@@ -4,49 +4,67 @@
 #include "tgaimage.h"
 #include "interval.h"
 
-class Vec3 {
+// the bounds, zero and NaN checks of the vector core throw in debug builds or with RAYTRACER_CHECKED_VECTORS
+// (to find where a NaN comes from), release builds compile them out so the operations are noexcept and inline
+#if defined(_DEBUG) || defined(RAYTRACER_CHECKED_VECTORS)
+constexpr bool CheckedVectors = true;
+#else
+constexpr bool CheckedVectors = false;
+#endif
+
+// T is the scalar, see Real in utility.h; geometry uses Vec3 (Real) and colors use Color (always double)
+template <typename T>
+class Vec3T {
 
 public:
 
+	using Scalar = T;
+
 	union {
 
 		struct {
-			double x, y, z;
+			T x, y, z;
 		};
 
 		struct {
-			double r, g, b;
+			T r, g, b;
 		};
 
-		double data[3];
+		T data[3];
 	};
 
-	Vec3() : x(0), y(0), z(0) {}
-	Vec3(double x, double y, double z) : x(x), y(y), z(z) {}
-	Vec3(double value) : Vec3(value, value, value) {}
+	constexpr Vec3T() noexcept : x(0), y(0), z(0) {}
+	constexpr Vec3T(T x, T y, T z) noexcept : x(x), y(y), z(z) {}
+	constexpr Vec3T(T value) noexcept : Vec3T(value, value, value) {}
+
+	// float and double vectors only mix where it is spelled out
+	template <typename U>
+	constexpr explicit Vec3T(const Vec3T<U>& other) noexcept : x(T(other.x)), y(T(other.y)), z(T(other.z)) {}
 
-	double operator [](int i) {
+	T& operator [](int i) noexcept(!CheckedVectors) {
 
-		if (i >= 3) {
-			throw std::runtime_error("Access out of bound");
+		if constexpr (CheckedVectors) {
+			if (i < 0 || i >= 3)
+				throw std::runtime_error("Access out of bound");
 		}
 		return data[i];
 	}
 
-	const double& operator [](size_t i) const {
+	const T& operator [](size_t i) const noexcept(!CheckedVectors) {
 
-		if (i >= 3) {
-			throw std::runtime_error("Access out of bound");
+		if constexpr (CheckedVectors) {
+			if (i >= 3)
+				throw std::runtime_error("Access out of bound");
 		}
 		return data[i];
 	}
 
-	Vec3 operator -() const {
+	constexpr Vec3T operator -() const noexcept {
 
-		return Vec3(-x, -y, -z);
+		return Vec3T(-x, -y, -z);
 	}
 
-	Vec3& operator +=(const Vec3& other) {
+	constexpr Vec3T& operator +=(const Vec3T& other) noexcept {
 
 		x += other.x;
 		y += other.y;
@@ -54,7 +72,7 @@ public:
 		return *this;
 	}
 
-	Vec3& operator -=(const Vec3& other) {
+	constexpr Vec3T& operator -=(const Vec3T& other) noexcept {
 
 		x -= other.x;
 		y -= other.y;
@@ -62,7 +80,7 @@ public:
 		return *this;
 	}
 
-	Vec3& operator *=(const double v) {
+	constexpr Vec3T& operator *=(const T v) noexcept {
 
 		x *= v;
 		y *= v;
@@ -70,10 +88,11 @@ public:
 		return *this;
 	}
 
-	Vec3& operator /=(const double v) {
+	Vec3T& operator /=(const T v) noexcept(!CheckedVectors) {
 
-		if (v == 0) {
-			throw std::runtime_error("Division by zero");
+		if constexpr (CheckedVectors) {
+			if (v == 0 || std::isnan(v))
+				throw std::runtime_error("Division by zero or NaN");
 		}
 
 		x /= v;
@@ -82,142 +101,164 @@ public:
 		return *this;
 	}
 
-	double length() const {
-		return sqrt(length2());
+	T length() const noexcept {
+		return std::sqrt(length2());
 	}
 
-	double length2() const {
+	constexpr T length2() const noexcept {
 		return x * x + y * y + z * z;
 	}
 
-	static Vec3 random(double min = 0, double max = 1) {
+	static Vec3T random(double min = 0, double max = 1) {
 	
-		return Vec3(RandomDouble(min, max), RandomDouble(min, max), RandomDouble(min, max));
+		return Vec3T(T(RandomDouble(min, max)), T(RandomDouble(min, max)), T(RandomDouble(min, max)));
 	}
 
-	static Vec3 randomUnitVector();
+	static Vec3T randomUnitVector();
 
-	static Vec3 randomOnHemisphere(const Vec3& normal);
+	static Vec3T randomOnHemisphere(const Vec3T& normal);
 
-	static Vec3 randomInUnitDisk();
+	static Vec3T randomInUnitDisk();
 
-	bool nearZero() const {
+	bool nearZero() const noexcept {
 
-		const double s = 1e-8;
+		const T s = T(1e-8);
 		return (fabs(x) < s) && (fabs(y) < s) && (fabs(z) < s);
 	}
 };
 
-inline std::ostream& operator<<(std::ostream& out, const Vec3& vec) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const Vec3T<T>& vec) {
 
 	out << vec.x << ' ' << vec.y << ' ' << vec.z;
 	return out;
 }
 
-inline Vec3 operator +(Vec3 vec1, Vec3 vec2) {
+template <typename T>
+constexpr Vec3T<T> operator +(Vec3T<T> vec1, Vec3T<T> vec2) noexcept {
 
-	return Vec3(vec1.x + vec2.x, vec1.y + vec2.y, vec1.z + vec2.z);
+	return Vec3T<T>(vec1.x + vec2.x, vec1.y + vec2.y, vec1.z + vec2.z);
 }
 
-inline Vec3 operator -(Vec3 vec1, Vec3 vec2) {
+template <typename T>
+constexpr Vec3T<T> operator -(Vec3T<T> vec1, Vec3T<T> vec2) noexcept {
 
-	return Vec3(vec1.x - vec2.x, vec1.y - vec2.y, vec1.z - vec2.z);
+	return Vec3T<T>(vec1.x - vec2.x, vec1.y - vec2.y, vec1.z - vec2.z);
 }
 
-inline Vec3 operator *(Vec3 vec1, Vec3 vec2) {
+template <typename T>
+constexpr Vec3T<T> operator *(Vec3T<T> vec1, Vec3T<T> vec2) noexcept {
 
-	return Vec3(vec1.x * vec2.x, vec1.y * vec2.y, vec1.z * vec2.z);
+	return Vec3T<T>(vec1.x * vec2.x, vec1.y * vec2.y, vec1.z * vec2.z);
 }
 
-inline Vec3 operator *(Vec3 vec, double v) {
+// the scalar is converted to the vector's type instead of taking part in deducing it
+template <typename T>
+constexpr Vec3T<T> operator *(Vec3T<T> vec, typename Vec3T<T>::Scalar v) noexcept {
 
-	return Vec3(vec.x * v, vec.y * v, vec.z * v);
+	return Vec3T<T>(vec.x * v, vec.y * v, vec.z * v);
 }
 
-inline Vec3 operator *(double v, Vec3 vec) {
+template <typename T>
+constexpr Vec3T<T> operator *(typename Vec3T<T>::Scalar v, Vec3T<T> vec) noexcept {
 
 	return vec * v;
 }
 
-inline Vec3 operator /(Vec3 vec, double v) {
+template <typename T>
+inline Vec3T<T> operator /(Vec3T<T> vec, typename Vec3T<T>::Scalar v) noexcept(!CheckedVectors) {
 
-	if (v == 0) {
-		throw std::runtime_error("Division by zero");
+	if constexpr (CheckedVectors) {
+		if (v == 0 || std::isnan(v))
+			throw std::runtime_error("Division by zero or NaN");
 	}
 
 	return vec * (1 / v);
 }
 
-inline double dot(Vec3 vec1, Vec3 vec2) {
+template <typename T>
+constexpr T dot(Vec3T<T> vec1, Vec3T<T> vec2) noexcept {
 
 	return vec1.x * vec2.x + vec1.y * vec2.y + vec1.z * vec2.z;
 }
 
-inline Vec3 cross(Vec3 vec1, Vec3 vec2) {
+template <typename T>
+constexpr Vec3T<T> cross(Vec3T<T> vec1, Vec3T<T> vec2) noexcept {
 
-	return Vec3(vec1.y * vec2.z - vec2.y * vec1.z, vec1.z * vec2.x - vec2.z * vec1.x, vec1.x * vec2.y - vec2.x * vec1.y);
+	return Vec3T<T>(vec1.y * vec2.z - vec2.y * vec1.z, vec1.z * vec2.x - vec2.z * vec1.x, vec1.x * vec2.y - vec2.x * vec1.y);
 }
 
-inline Vec3 normalize(Vec3 vec1) {
+template <typename T>
+inline Vec3T<T> normalize(Vec3T<T> vec1) noexcept(!CheckedVectors) {
 
-	double len = vec1.length();
-	if (len == 0) {
-		throw std::runtime_error("Zero length vector");
+	T len = vec1.length();
+	if constexpr (CheckedVectors) {
+		if (len == 0 || std::isnan(len))
+			throw std::runtime_error("Zero length or NaN vector");
 	}
-	return Vec3(vec1.x / len, vec1.y / len, vec1.z / len);
+	return Vec3T<T>(vec1.x / len, vec1.y / len, vec1.z / len);
 }
 
-inline Vec3 reflect(const Vec3& v, const Vec3& n)
+template <typename T>
+constexpr Vec3T<T> reflect(const Vec3T<T>& v, const Vec3T<T>& n) noexcept
 {
 	return v - 2 * dot(v, n) * n;
 }
 
-inline Vec3 refract(const Vec3& v, const Vec3& n, double ratio) 
+template <typename T>
+inline Vec3T<T> refract(const Vec3T<T>& v, const Vec3T<T>& n, typename Vec3T<T>::Scalar ratio) noexcept(!CheckedVectors)
 {
-	double length = v.length();
-	Vec3 incident = v / length;
-	double c1 = abs(dot(incident, n));
-	double c2 = sqrt(1 - ratio * ratio * (1 - c1 * c1));
+	T length = v.length();
+	Vec3T<T> incident = v / length;
+	T c1 = std::abs(dot(incident, n));
+	T c2 = std::sqrt(1 - ratio * ratio * (1 - c1 * c1));
 
 	return length * (ratio * incident + (ratio * c1 - c2) * n);
 }
 
-Vec3 Vec3::randomUnitVector() {
+template <typename T>
+Vec3T<T> Vec3T<T>::randomUnitVector() {
 
 	while (true) {
-		Vec3 p = Vec3::random(-1, 1);
-		double len = p.length2();
-		if (len > 1e-100 && len <= 1)
-			return p /= sqrt(len);
+		Vec3T p = Vec3T::random(-1, 1);
+		T len = p.length2();
+		if (len > (std::numeric_limits<T>::min)() && len <= 1)
+			return p /= std::sqrt(len);
 	}
 }
 
-Vec3 Vec3::randomOnHemisphere(const Vec3& normal) {
+template <typename T>
+Vec3T<T> Vec3T<T>::randomOnHemisphere(const Vec3T& normal) {
 
-	Vec3 p = Vec3::randomUnitVector();
+	Vec3T p = Vec3T::randomUnitVector();
 	if (dot(p, normal) < 0)
 		p = -p;
 	return p;
 }
 
-Vec3 Vec3::randomInUnitDisk() {
+template <typename T>
+Vec3T<T> Vec3T<T>::randomInUnitDisk() {
 
 	while (true) {
-		Vec3 p = Vec3(RandomDouble(-1, 1), RandomDouble(-1, 1), 0);
+		Vec3T p = Vec3T(T(RandomDouble(-1, 1)), T(RandomDouble(-1, 1)), 0);
 		if (p.length2() <= 1)
 			return p;
 	}
 }
 
-inline Vec3 toColor(TGAColor tgaColor)
+using Vec3 = Vec3T<Real>;
+using vec3 = Vec3;
+using Color = Vec3T<double>;
+
+inline Color toColor(TGAColor tgaColor)
 {
-	return Vec3(tgaColor[2] / 255.0, tgaColor[1] / 255.0, tgaColor[0] / 255.0);
+	return Color(tgaColor[2] / 255.0, tgaColor[1] / 255.0, tgaColor[0] / 255.0);
 }
 
-inline TGAColor toTGAColor(Vec3 color) 
+inline TGAColor toTGAColor(Color color) 
 {
 	TGAColor tga;
-	Interval intensity(0, 0.999);
+	IntervalT<double> intensity(0, 0.999);
 
 	tga[0] = static_cast<unsigned char>(intensity.clamp(color.b) * 256);
 	tga[1] = static_cast<unsigned char>(intensity.clamp(color.g) * 256);
@@ -227,7 +268,7 @@ inline TGAColor toTGAColor(Vec3 color)
 	return tga;
 }
 
-inline Vec3 linearToGamma(Vec3 color)
+inline Color linearToGamma(Color color)
 {
 	color.x = pow(color.x, 1 / 2.2);
 	color.y = pow(color.y, 1 / 2.2);
@@ -235,13 +276,10 @@ inline Vec3 linearToGamma(Vec3 color)
 	return color;
 }
 
-inline Vec3 gammaToLinear(Vec3 color)
+inline Color gammaToLinear(Color color)
 {
 	color.x = pow(color.x, 2.2);
 	color.y = pow(color.y, 2.2);
 	color.z = pow(color.z, 2.2);
 	return color;
-}
-
-using vec3 = Vec3;
-using Color = Vec3;
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "hittable_list.h"
+#include "bvh_builder.h"
+#include "simd.h"
+#include <cstdint>
+
+// a node with up to Width children, their boxes are stored per axis so one SIMD slab test covers all of them
+template<int Width>
+struct alignas(32) WideBVHNode
+{
+	float bounds_[2][3][Width]; // [min / max][axis][child], unused slots hold an inverted box that no ray hits
+	int32_t child_[Width]; // interior children: node index, leaves: first primitive
+	uint8_t primitive_count_[Width]; // 0 for interior children
+	uint8_t child_count_;
+};
+
+// what every slab test needs from the ray, computed once per traversal
+struct WideRay
+{
+	float origin_[3];
+	float inverse_direction_[3];
+	int sign_[3]; // 1 when the direction is negative, then the max plane is entered first
+};
+
+template<int Width>
+struct WideSlabTest;
+
+// returns a bit per child whose box overlaps [t_min, t_max], writes the entry distances to t_near;
+// near and far planes are picked by the direction sign, so zero components and inverted boxes need no special case
+template<>
+struct WideSlabTest<4>
+{
+	static int hit(const WideBVHNode<4>& node, const WideRay& ray, float t_min, float t_max, float* t_near)
+	{
+#if defined(RT_SIMD_X86)
+		__m128 near_t = _mm_set1_ps(t_min), far_t = _mm_set1_ps(t_max);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m128 origin = _mm_set1_ps(ray.origin_[axis]), inverse_direction = _mm_set1_ps(ray.inverse_direction_[axis]);
+			__m128 enter = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds_[ray.sign_[axis]][axis]), origin), inverse_direction);
+			__m128 leave = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds_[1 - ray.sign_[axis]][axis]), origin), inverse_direction);
+			// maxps and minps return the second operand for NaN (origin on a plane of a zero direction axis)
+			near_t = _mm_max_ps(enter, near_t);
+			far_t = _mm_min_ps(leave, far_t);
+		}
+		_mm_store_ps(t_near, near_t);
+		return _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+#elif defined(RT_SIMD_NEON)
+		float32x4_t near_t = vdupq_n_f32(t_min), far_t = vdupq_n_f32(t_max);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float32x4_t origin = vdupq_n_f32(ray.origin_[axis]), inverse_direction = vdupq_n_f32(ray.inverse_direction_[axis]);
+			float32x4_t enter = vmulq_f32(vsubq_f32(vld1q_f32(node.bounds_[ray.sign_[axis]][axis]), origin), inverse_direction);
+			float32x4_t leave = vmulq_f32(vsubq_f32(vld1q_f32(node.bounds_[1 - ray.sign_[axis]][axis]), origin), inverse_direction);
+			// the nm variants ignore NaN operands
+			near_t = vmaxnmq_f32(enter, near_t);
+			far_t = vminnmq_f32(leave, far_t);
+		}
+		vst1q_f32(t_near, near_t);
+		uint32_t lanes[4];
+		vst1q_u32(lanes, vcleq_f32(near_t, far_t));
+		return (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+#else
+		int mask = 0;
+		for (int child = 0; child < 4; child++)
+		{
+			float near_t = t_min, far_t = t_max;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float enter = (node.bounds_[ray.sign_[axis]][axis][child] - ray.origin_[axis]) * ray.inverse_direction_[axis];
+				float leave = (node.bounds_[1 - ray.sign_[axis]][axis][child] - ray.origin_[axis]) * ray.inverse_direction_[axis];
+				near_t = (enter > near_t) ? enter : near_t;
+				far_t = (leave < far_t) ? leave : far_t;
+			}
+			t_near[child] = near_t;
+			mask |= (near_t <= far_t) << child;
+		}
+		return mask;
+#endif
+	}
+};
+
+template<>
+struct WideSlabTest<8>
+{
+#if defined(RT_SIMD_X86)
+	RT_TARGET_AVX2 static int hit(const WideBVHNode<8>& node, const WideRay& ray, float t_min, float t_max, float* t_near)
+	{
+		__m256 near_t = _mm256_set1_ps(t_min), far_t = _mm256_set1_ps(t_max);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256 origin = _mm256_set1_ps(ray.origin_[axis]), inverse_direction = _mm256_set1_ps(ray.inverse_direction_[axis]);
+			__m256 enter = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_[ray.sign_[axis]][axis]), origin), inverse_direction);
+			__m256 leave = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds_[1 - ray.sign_[axis]][axis]), origin), inverse_direction);
+			near_t = _mm256_max_ps(enter, near_t);
+			far_t = _mm256_min_ps(leave, far_t);
+		}
+		_mm256_store_ps(t_near, near_t);
+		return _mm256_movemask_ps(_mm256_cmp_ps(near_t, far_t, _CMP_LE_OQ));
+	}
+#else
+	static int hit(const WideBVHNode<8>& node, const WideRay& ray, float t_min, float t_max, float* t_near)
+	{
+		return 0; // never built, WideBVH only picks 8 children with AVX2
+	}
+#endif
+};
+
+template<int Width>
+class WideBVH : public Hittable
+{
+
+	struct StackEntry
+	{
+		int32_t child_;
+		int32_t primitive_count_;
+		float t_near_;
+	};
+
+	// the binary tree is limited to this depth, every wide level consumes at least one binary level
+	static const int max_depth_ = 64;
+	static const int stack_size_ = (Width - 1) * max_depth_ + 1;
+
+	std::vector<WideBVHNode<Width>> nodes_;
+	std::vector<std::shared_ptr<Hittable>> primitives_;
+	std::vector<const Hittable*> primitive_pointers_;
+	AABB bounding_box_;
+	BVHStatistics statistics_;
+
+	void setChild(WideBVHNode<Width>& node, int slot, const BVHBuildNode& child, int32_t index)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lower = float(child.bounding_box_.data_[axis].min_), upper = float(child.bounding_box_.data_[axis].max_);
+			node.bounds_[0][axis][slot] = (lower > child.bounding_box_.data_[axis].min_) ? std::nextafter(lower, -std::numeric_limits<float>::infinity()) : lower;
+			node.bounds_[1][axis][slot] = (upper < child.bounding_box_.data_[axis].max_) ? std::nextafter(upper, std::numeric_limits<float>::infinity()) : upper;
+		}
+		node.child_[slot] = index;
+		node.primitive_count_[slot] = uint8_t(child.isLeaf() ? child.primitive_count_ : 0);
+	}
+
+	// pulls grandchildren up until the node holds Width children, always opening the biggest interior child
+	int collapse(const std::vector<BVHBuildNode>& build_nodes, int build_index)
+	{
+		int children[Width];
+		int child_count = 0;
+		const BVHBuildNode& build_node = build_nodes[build_index];
+		if (build_node.isLeaf())
+			children[child_count++] = build_index;
+		else
+			children[child_count++] = build_node.left_, children[child_count++] = build_node.right_;
+
+		while (child_count < Width)
+		{
+			int biggest = -1;
+			double biggest_area = -1;
+			for (int i = 0; i < child_count; i++)
+			{
+				const BVHBuildNode& child = build_nodes[children[i]];
+				if (!child.isLeaf() && child.bounding_box_.surfaceArea() > biggest_area)
+					biggest = i, biggest_area = child.bounding_box_.surfaceArea();
+			}
+			if (biggest < 0)
+				break;
+			const BVHBuildNode& opened = build_nodes[children[biggest]];
+			children[biggest] = opened.left_;
+			children[child_count++] = opened.right_;
+		}
+
+		int node_index = int(nodes_.size());
+		nodes_.emplace_back();
+		WideBVHNode<Width>& node = nodes_[node_index];
+		for (int slot = 0; slot < Width; slot++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+				node.bounds_[0][axis][slot] = Infinity, node.bounds_[1][axis][slot] = -Infinity;
+			node.child_[slot] = -1;
+			node.primitive_count_[slot] = 0;
+		}
+		node.child_count_ = uint8_t(child_count);
+
+		for (int slot = 0; slot < child_count; slot++)
+		{
+			const BVHBuildNode& child = build_nodes[children[slot]];
+			int32_t index = child.isLeaf() ? child.first_primitive_ : collapse(build_nodes, children[slot]);
+			setChild(nodes_[node_index], slot, child, index);
+		}
+		return node_index;
+	}
+
+public:
+
+	WideBVH(const HittableList& list, BVHBuildOptions options = BVHBuildOptions())
+	{
+		std::vector<AABB> bounds;
+		bounds.reserve(list.objects_.size());
+		for (const auto& object : list.objects_)
+			bounds.push_back(object->getBoundingBox());
+
+		// leaf counts have to fit in a byte
+		options.max_leaf_size_ = (options.max_leaf_size_ > 255) ? 255 : options.max_leaf_size_;
+		BVHBuilder builder(bounds, options);
+		if (builder.getStatistics().depth_ > max_depth_)
+		{
+			options.method_ = BVHBuildOptions::Method::Median;
+			builder = BVHBuilder(bounds, options);
+		}
+
+		collapse(builder.getNodes(), 0);
+		const std::vector<int>& order = builder.getPrimitiveOrder();
+		primitives_.resize(order.size());
+		primitive_pointers_.resize(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			primitives_[i] = list.objects_[order[i]];
+			primitive_pointers_[i] = primitives_[i].get();
+		}
+		bounding_box_ = builder.getNodes()[0].bounding_box_;
+		statistics_ = builder.getStatistics();
+	}
+
+	bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		WideRay ray;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			ray.origin_[axis] = float(r.orig_.data[axis]);
+			ray.inverse_direction_[axis] = float(r.inverse_dir_.data[axis]);
+			ray.sign_[axis] = r.sign_[axis];
+		}
+
+		StackEntry stack[stack_size_];
+		int stack_top = 0;
+		stack[stack_top++] = { 0, 0, -std::numeric_limits<float>::infinity() };
+		bool hit_anything = false;
+		alignas(32) float t_near[Width];
+
+		while (stack_top > 0)
+		{
+			StackEntry entry = stack[--stack_top];
+			if (entry.t_near_ > ray_t.max_)
+				continue;
+
+			if (entry.primitive_count_ > 0)
+			{
+				for (int i = 0; i < entry.primitive_count_; i++)
+					if (primitive_pointers_[entry.child_ + i]->hit(r, ray_t, rec))
+					{
+						hit_anything = true;
+						ray_t.max_ = rec.t_;
+					}
+				continue;
+			}
+
+			const WideBVHNode<Width>& node = nodes_[entry.child_];
+			// float rounding could lose a grazing hit, so the far distance is widened by a few ulps
+			float t_max = float(ray_t.max_) * (1 + 4 * std::numeric_limits<float>::epsilon());
+			int mask = WideSlabTest<Width>::hit(node, ray, float(ray_t.min_), t_max, t_near) & ((1 << node.child_count_) - 1);
+
+			// sorted far to near, so the nearest child is popped first
+			int first = stack_top;
+			for (int slot = 0; mask; slot++, mask >>= 1)
+			{
+				if (!(mask & 1))
+					continue;
+				StackEntry child = { node.child_[slot], node.primitive_count_[slot], t_near[slot] };
+				int i = stack_top++;
+				for (; i > first && stack[i - 1].t_near_ < child.t_near_; i--)
+					stack[i] = stack[i - 1];
+				stack[i] = child;
+			}
+		}
+
+		return hit_anything;
+	}
+
+	bool occluded(const Ray& r, Interval ray_t) const override
+	{
+		if (primitive_pointers_.empty())
+			return false;
+
+		WideRay ray;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			ray.origin_[axis] = float(r.orig_.data[axis]);
+			ray.inverse_direction_[axis] = float(r.inverse_dir_.data[axis]);
+			ray.sign_[axis] = r.sign_[axis];
+		}
+
+		// only interior nodes go on the stack, leaves are tested as soon as their parent is
+		int32_t stack[stack_size_];
+		int stack_top = 0;
+		stack[stack_top++] = 0;
+		alignas(32) float t_near[Width];
+		float t_max = float(ray_t.max_) * (1 + 4 * std::numeric_limits<float>::epsilon());
+
+		while (stack_top > 0)
+		{
+			const WideBVHNode<Width>& node = nodes_[stack[--stack_top]];
+			int mask = WideSlabTest<Width>::hit(node, ray, float(ray_t.min_), t_max, t_near) & ((1 << node.child_count_) - 1);
+
+			for (int slot = 0; mask; slot++, mask >>= 1)
+			{
+				if (!(mask & 1))
+					continue;
+				if (node.primitive_count_[slot] == 0)
+				{
+					stack[stack_top++] = node.child_[slot];
+					continue;
+				}
+				for (int i = 0; i < node.primitive_count_[slot]; i++)
+					if (primitive_pointers_[node.child_[slot] + i]->occluded(r, ray_t))
+						return true;
+			}
+		}
+
+		return false;
+	}
+
+	AABB getBoundingBox() const override
+	{
+		return bounding_box_;
+	}
+
+	void collectLights(std::vector<const Hittable*>& lights) const override
+	{
+		for (const Hittable* primitive : primitive_pointers_)
+			primitive->collectLights(lights);
+	}
+
+	const BVHStatistics& getStatistics() const
+	{
+		return statistics_;
+	}
+};
+
+// 8 children when the cpu runs AVX2, else 4 (SSE on x86-64, NEON on ARM); width 4 forces the narrow layout
+inline std::shared_ptr<Hittable> MakeWideBVH(const HittableList& list, const BVHBuildOptions& options = BVHBuildOptions(), int width = 0, BVHStatistics* statistics = nullptr)
+{
+	if (width != 4 && CpuSupportsAVX2())
+	{
+		auto bvh = std::make_shared<WideBVH<8>>(list, options);
+		if (statistics)
+			*statistics = bvh->getStatistics();
+		return bvh;
+	}
+
+	auto bvh = std::make_shared<WideBVH<4>>(list, options);
+	if (statistics)
+		*statistics = bvh->getStatistics();
+	return bvh;
+}